@@ -0,0 +1,161 @@
+#include "Catalog.h"
+#include "Json.h"
+
+Catalog catalog;
+
+std::optional<int64_t> parseId(std::string_view text) {
+	int64_t id;
+	auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), id);
+	if (ec != std::errc() || end != text.data() + text.size()) return std::nullopt;
+	return id;
+}
+
+static std::string foldCase(std::string_view text) {
+	std::string folded(text);
+	for (char &c : folded) {
+		if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+	}
+	return folded;
+}
+
+static std::string columnText(sqlite3_stmt *stmt, int column) {
+	const char *text = (const char*)sqlite3_column_text(stmt, column);
+	return text ? std::string(text, sqlite3_column_bytes(stmt, column)) : std::string();
+}
+
+//################################################
+// snapshot
+
+bool CatalogMovie::nameStartsWith(std::string_view prefix) const {
+	if (prefix.size() > folded.size()) return(false);
+	for (size_t i = 0; i < prefix.size(); i++) {
+		char c = prefix[i];
+		if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+		if (folded[i] != c) return(false);
+	}
+	return(true);
+}
+
+const CatalogMovie *CatalogSnapshot::movie(int64_t id) const {
+	auto it = std::lower_bound(movies.begin(), movies.end(), id,
+		[](const CatalogMovie &m, int64_t id) { return m.id < id; });
+	return (it != movies.end() && it->id == id) ? &*it : nullptr;
+}
+
+const CatalogTheater *CatalogSnapshot::theater(std::string_view name) const {
+	auto it = std::lower_bound(theatersByName.begin(), theatersByName.end(), name,
+		[this](uint32_t i, std::string_view name) { return theaters[i].name < name; });
+	return (it != theatersByName.end() && theaters[*it].name == name) ? &theaters[*it] : nullptr;
+}
+
+CatalogSnapshot::Range CatalogSnapshot::nameRange(std::string_view prefix) const {
+	std::string folded = foldCase(prefix);
+	auto first = std::lower_bound(byName.begin(), byName.end(), folded,
+		[this](uint32_t i, const std::string &key) { return movies[i].folded < key; });
+	auto last = first;
+	while (last != byName.end() && movies[*last].folded.compare(0, folded.size(), folded) == 0) last++;
+	return {byName.data() + (first - byName.begin()), byName.data() + (last - byName.begin())};
+}
+
+CatalogSnapshot::Range CatalogSnapshot::showtimeRange(std::string_view showtime) const {
+	auto first = std::lower_bound(byShowtime.begin(), byShowtime.end(), showtime,
+		[this](uint32_t i, std::string_view key) { return movies[i].showtime < key; });
+	auto last = std::upper_bound(first, byShowtime.end(), showtime,
+		[this](std::string_view key, uint32_t i) { return key < movies[i].showtime; });
+	return {byShowtime.data() + (first - byShowtime.begin()), byShowtime.data() + (last - byShowtime.begin())};
+}
+
+CatalogSnapshot::Range CatalogSnapshot::theaterRange(int64_t theater_id) const {
+	auto first = std::lower_bound(byTheater.begin(), byTheater.end(), theater_id,
+		[this](uint32_t i, int64_t key) { return movies[i].theater_id < key; });
+	auto last = std::upper_bound(first, byTheater.end(), theater_id,
+		[this](int64_t key, uint32_t i) { return key < movies[i].theater_id; });
+	return {byTheater.data() + (first - byTheater.begin()), byTheater.data() + (last - byTheater.begin())};
+}
+
+CatalogSnapshot::Range CatalogSnapshot::all() const {
+	return {everything.data(), everything.data() + everything.size()};
+}
+
+void CatalogSnapshot::buildIndexes() {
+	everything.resize(movies.size());
+	std::iota(everything.begin(), everything.end(), 0);
+
+	// movies is in id order, so a stable sort leaves ties in id order too
+	byName = everything;
+	std::stable_sort(byName.begin(), byName.end(),
+		[this](uint32_t a, uint32_t b) { return movies[a].folded < movies[b].folded; });
+	byShowtime = everything;
+	std::stable_sort(byShowtime.begin(), byShowtime.end(),
+		[this](uint32_t a, uint32_t b) { return movies[a].showtime < movies[b].showtime; });
+	byTheater = everything;
+	std::stable_sort(byTheater.begin(), byTheater.end(),
+		[this](uint32_t a, uint32_t b) { return movies[a].theater_id < movies[b].theater_id; });
+
+	theatersByName.resize(theaters.size());
+	std::iota(theatersByName.begin(), theatersByName.end(), 0);
+	std::stable_sort(theatersByName.begin(), theatersByName.end(),
+		[this](uint32_t a, uint32_t b) { return theaters[a].name < theaters[b].name; });
+}
+
+//################################################
+// catalog
+
+bool Catalog::reload(Connection &conn) {
+	auto next = std::make_shared<CatalogSnapshot>();
+
+	{
+		Statement stmt(conn, Stmt::LoadMovies);
+		if (!stmt) return(false);
+
+		int rc;
+		while ((rc = stmt.step()) == SQLITE_ROW) {
+			CatalogMovie movie;
+			movie.id = sqlite3_column_int64(stmt, 0);
+			movie.name = columnText(stmt, 1);
+			movie.folded = foldCase(movie.name);
+			movie.showtime = columnText(stmt, 2);
+			movie.price = sqlite3_column_double(stmt, 3);
+			movie.rating = columnText(stmt, 4);
+			movie.theater_id = sqlite3_column_int64(stmt, 5);
+
+			JsonWriter json(128);
+			json.row(stmt);
+			movie.json = json.take();
+
+			next->movies.push_back(std::move(movie));
+		}
+		if (rc != SQLITE_DONE) return(false);
+	}
+
+	{
+		Statement stmt(conn, Stmt::LoadTheaters);
+		if (!stmt) return(false);
+
+		int rc;
+		while ((rc = stmt.step()) == SQLITE_ROW) {
+			next->theaters.push_back({sqlite3_column_int64(stmt, 0), columnText(stmt, 1)});
+		}
+		if (rc != SQLITE_DONE) return(false);
+	}
+
+	next->buildIndexes();
+
+	// Publish the pointer before the version, so a reader that sees the new
+	// version is guaranteed to pick up this snapshot (or a later one)
+	std::atomic_store(&current, std::shared_ptr<const CatalogSnapshot>(std::move(next)));
+	version.fetch_add(1, std::memory_order_release);
+	return(true);
+}
+
+const CatalogSnapshot &Catalog::snapshot() {
+	thread_local uint64_t seen = 0;
+	thread_local std::shared_ptr<const CatalogSnapshot> cached;
+
+	uint64_t latest = version.load(std::memory_order_acquire);
+	if (latest != seen) {
+		cached = std::atomic_load(&current);
+		seen = latest;
+	}
+	return *cached;
+}
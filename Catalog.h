@@ -0,0 +1,87 @@
+#pragma once
+#include "Util.h"
+#include "Database.h"
+
+struct CatalogMovie {
+	int64_t id;
+	std::string name;
+	std::string folded;   // name lowercased, LIKE only folds ASCII so neither do we
+	std::string showtime;
+	double price;
+	std::string rating;
+	int64_t theater_id;
+	std::string json;     // the whole row, already rendered the way listmovies returns it
+
+	// Same test as name LIKE 'prefix%'
+	bool nameStartsWith(std::string_view prefix) const;
+};
+
+struct CatalogTheater {
+	int64_t id;
+	std::string name;
+};
+
+/*
+ * Every movie and theater as of one point in time. Built once by
+ * Catalog::reload() and never changed afterwards, so any number of threads
+ * can read it at once.
+ *
+ * The indexes hold positions into movies/theaters, sorted by the key they
+ * are named after with ties broken by id.
+ */
+class CatalogSnapshot {
+public:
+	using Range = std::pair<const uint32_t*, const uint32_t*>;
+
+	std::vector<CatalogMovie> movies;     // ordered by id
+	std::vector<CatalogTheater> theaters; // ordered by id
+	std::vector<uint32_t> byName;
+	std::vector<uint32_t> byShowtime;
+	std::vector<uint32_t> byTheater;
+	std::vector<uint32_t> theatersByName;
+
+	const CatalogMovie *movie(int64_t id) const;
+	const CatalogTheater *theater(std::string_view name) const;
+
+	// Movies whose name starts with prefix, ignoring ASCII case
+	Range nameRange(std::string_view prefix) const;
+	Range showtimeRange(std::string_view showtime) const;
+	Range theaterRange(int64_t theater_id) const;
+	Range all() const;
+
+private:
+	std::vector<uint32_t> everything;
+
+	friend class Catalog;
+	void buildIndexes();
+};
+
+/*
+ * In-memory copy of the Movies and Theaters tables, so listmovies,
+ * getmovie and gettheater never touch the database.
+ *
+ * reload() builds a whole new snapshot and swaps it in; whoever is still
+ * reading the old one keeps it alive until they are done. Readers don't
+ * lock anything: each thread keeps the last snapshot it saw and only goes
+ * back to the shared pointer when the version number has moved.
+ *
+ * Anything that changes either table must call reload() once the change is
+ * committed.
+ */
+class Catalog {
+	std::shared_ptr<const CatalogSnapshot> current;
+	std::atomic<uint64_t> version{1};
+
+public:
+	Catalog() : current(std::make_shared<CatalogSnapshot>()) {}
+
+	bool reload(Connection &conn);
+
+	// Valid until this thread next calls snapshot()
+	const CatalogSnapshot &snapshot();
+};
+
+extern Catalog catalog;
+
+// Whole-string integer parse, for ids that arrive as query parameters
+std::optional<int64_t> parseId(std::string_view text);
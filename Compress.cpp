@@ -0,0 +1,154 @@
+#include "Compress.h"
+#include "Config.h"
+#include <zlib.h>
+
+CompressedCache compressedCache;
+
+static std::atomic<uint64_t> compressedResponses{0};
+static std::atomic<uint64_t> compressedBytesIn{0};
+static std::atomic<uint64_t> compressedBytesOut{0};
+static std::atomic<uint64_t> compressedCacheHits{0};
+
+//################################################
+// negotiation
+
+// q value of one Accept-Encoding entry's parameters, 1 if it has none
+static double qualityOf(std::string_view params) {
+	size_t q = params.find("q=");
+	if (q == std::string_view::npos) return 1;
+	std::string value(params.substr(q + 2));
+	return strtod(value.c_str(), nullptr);
+}
+
+Encoding negotiateEncoding(std::string_view acceptEncoding) {
+	// -1 until named, a coding refused by name with q=0 stays refused
+	double gzip = -1, deflate = -1, any = -1;
+	while (!acceptEncoding.empty()) {
+		size_t comma = acceptEncoding.find(',');
+		std::string_view entry = acceptEncoding.substr(0, comma);
+		acceptEncoding.remove_prefix(comma == std::string_view::npos ? acceptEncoding.size() : comma + 1);
+
+		size_t semi = entry.find(';');
+		std::string_view coding = entry.substr(0, semi);
+		while (!coding.empty() && coding.front() == ' ') coding.remove_prefix(1);
+		while (!coding.empty() && coding.back() == ' ') coding.remove_suffix(1);
+		double q = semi == std::string_view::npos ? 1 : qualityOf(entry.substr(semi + 1));
+
+		if (coding == "gzip" || coding == "x-gzip") gzip = q;
+		else if (coding == "deflate") deflate = q;
+		else if (coding == "*") any = q;
+	}
+	// * covers whatever wasn't named
+	if (gzip < 0) gzip = std::max(any, 0.0);
+	if (deflate < 0) deflate = std::max(any, 0.0);
+
+	if (gzip > 0 && gzip >= deflate) return Encoding::Gzip;
+	if (deflate > 0) return Encoding::Deflate;
+	return Encoding::Identity;
+}
+
+std::string_view encodingName(Encoding encoding) {
+	switch (encoding) {
+		case Encoding::Gzip: return "gzip";
+		case Encoding::Deflate: return "deflate";
+		default: return "";
+	}
+}
+
+//################################################
+// compression
+
+/*
+ * One thread's zlib stream for one encoding, set up on first use and reset
+ * after that. gzip and deflate differ only in the header zlib writes,
+ * picked by windowBits when the stream is set up.
+ */
+struct Compressor {
+	z_stream stream{};
+	bool ready = false;
+
+	bool begin(Encoding encoding) {
+		if (ready) return deflateReset(&stream) == Z_OK;
+		int windowBits = encoding == Encoding::Gzip ? 15 + 16 : 15;
+		ready = deflateInit2(&stream, config.compress_level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+		return ready;
+	}
+	~Compressor() {
+		if (ready) deflateEnd(&stream);
+	}
+};
+
+bool compressBody(std::string_view body, Encoding encoding, std::string &out) {
+	thread_local Compressor gzipCompressor, deflateCompressor;
+	Compressor &compressor = encoding == Encoding::Gzip ? gzipCompressor : deflateCompressor;
+	if (encoding == Encoding::Identity || !compressor.begin(encoding)) return(false);
+
+	z_stream &stream = compressor.stream;
+	out.resize(deflateBound(&stream, body.size()));
+	stream.next_in = (Bytef *)body.data();
+	stream.avail_in = (uInt)body.size();
+	stream.next_out = (Bytef *)out.data();
+	stream.avail_out = (uInt)out.size();
+
+	// The output was sized to fit, so one call does it all
+	if (deflate(&stream, Z_FINISH) != Z_STREAM_END) return(false);
+	out.resize(stream.total_out);
+
+	compressedResponses.fetch_add(1, std::memory_order_relaxed);
+	compressedBytesIn.fetch_add(body.size(), std::memory_order_relaxed);
+	compressedBytesOut.fetch_add(out.size(), std::memory_order_relaxed);
+	return(true);
+}
+
+CompressionStats compressionStats() {
+	return {
+		compressedResponses.load(std::memory_order_relaxed),
+		compressedBytesIn.load(std::memory_order_relaxed),
+		compressedBytesOut.load(std::memory_order_relaxed),
+		compressedCacheHits.load(std::memory_order_relaxed),
+	};
+}
+
+//################################################
+// cache
+
+// Neither the tag nor the encoding name has a space, so the target after them can't run into them
+std::string CompressedCache::keyFor(std::string_view target, std::string_view etag, Encoding encoding) {
+	std::string key;
+	key.reserve(etag.size() + target.size() + 8);
+	key += etag;
+	key += ' ';
+	key += encodingName(encoding);
+	key += ' ';
+	key += target;
+	return key;
+}
+
+std::shared_ptr<const std::string> CompressedCache::find(std::string_view target, std::string_view etag, Encoding encoding) {
+	if (!config.compress_cache) return nullptr;
+
+	std::string key = keyFor(target, etag, encoding);
+	Shard &shard = shardFor(key);
+	std::lock_guard<std::mutex> guard(shard.lock);
+	auto it = shard.bodies.find(key);
+	if (it == shard.bodies.end()) return nullptr;
+	compressedCacheHits.fetch_add(1, std::memory_order_relaxed);
+	return it->second;
+}
+
+void CompressedCache::store(std::string_view target, std::string_view etag, Encoding encoding, std::string body) {
+	// Rounded up, so a cache smaller than the shard count still keeps something
+	if (!config.compress_cache) return;
+	size_t perShard = (config.compress_cache + shardCount - 1) / shardCount;
+
+	std::string key = keyFor(target, etag, encoding);
+	auto shared = std::make_shared<const std::string>(std::move(body));
+	Shard &shard = shardFor(key);
+	std::lock_guard<std::mutex> guard(shard.lock);
+	if (!shard.bodies.emplace(key, std::move(shared)).second) return;
+	shard.order.push_back(std::move(key));
+	while (shard.order.size() > perShard) {
+		shard.bodies.erase(shard.order.front());
+		shard.order.pop_front();
+	}
+}
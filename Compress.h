@@ -0,0 +1,61 @@
+#pragma once
+#include "Util.h"
+
+/*
+ * Response compression. Bodies are gzip or deflate (zlib) encoded when the
+ * client's Accept-Encoding allows it and they are at least
+ * config.compress_min bytes long; shorter ones aren't worth the CPU.
+ *
+ * Each thread keeps one zlib stream per encoding and resets it between
+ * responses, so compressing doesn't set up and tear down zlib's state
+ * (a few hundred KiB) every time.
+ */
+enum class Encoding { Identity, Gzip, Deflate };
+
+// The best encoding an Accept-Encoding header allows, gzip first
+Encoding negotiateEncoding(std::string_view acceptEncoding);
+// Content-Encoding value, empty for Identity
+std::string_view encodingName(Encoding encoding);
+
+// False if zlib failed, out is left unspecified then
+bool compressBody(std::string_view body, Encoding encoding, std::string &out);
+
+struct CompressionStats {
+	uint64_t responses;
+	uint64_t bytesIn;
+	uint64_t bytesOut;
+	uint64_t cacheHits;
+};
+CompressionStats compressionStats();
+
+/*
+ * Compressed bodies of responses that have an ETag, keyed by the full
+ * target, tag and encoding. The tag only names the versions the response
+ * was built from, and the target is compared as it is, so an entry is only
+ * ever sent back to the request it was built for. It is never out of date:
+ * it just stops being asked for once the data moves on. Those are pushed
+ * out oldest first once a shard is full.
+ *
+ * Split into shards by key like SessionStore, so threads rarely wait on
+ * each other.
+ */
+class CompressedCache {
+public:
+	// Empty if there is nothing cached
+	std::shared_ptr<const std::string> find(std::string_view target, std::string_view etag, Encoding encoding);
+	void store(std::string_view target, std::string_view etag, Encoding encoding, std::string body);
+
+private:
+	struct alignas(64) Shard {
+		std::mutex lock;
+		std::unordered_map<std::string, std::shared_ptr<const std::string>> bodies;
+		std::deque<std::string> order; // oldest first
+	};
+	static constexpr size_t shardCount = 16;
+	Shard shards[shardCount];
+
+	Shard &shardFor(const std::string &key) { return shards[std::hash<std::string>()(key) % shardCount]; }
+	static std::string keyFor(std::string_view target, std::string_view etag, Encoding encoding);
+};
+
+extern CompressedCache compressedCache;
@@ -0,0 +1,51 @@
+#pragma once
+#include "Util.h"
+
+// Just to make things easier to change in the future
+#define DATABASE_FILE "movie_ticket_system.db"
+#define PORT 4444
+// Seats in a showing when addmovie isn't given a capacity
+#define DEFAULT_CAPACITY 100
+// Rows in one page of a list when the request doesn't give a limit, and the most it may ask for
+#define DEFAULT_PAGE_SIZE 100
+#define MAX_PAGE_SIZE 1000
+
+/*
+ * Runtime settings. Defaults live here, main() overrides them from the
+ * command line before anything else is started.
+ */
+struct Config {
+	unsigned short port = PORT;
+	unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+	unsigned int idle_timeout = 30; // seconds a kept-alive connection may sit idle
+	unsigned int db_connections = 0; // pooled read-only connections, never fewer than request plus hashing threads
+
+	// SQLite tuning, applied to every connection as it is opened
+	std::string synchronous = "NORMAL"; // NORMAL is durable enough in WAL mode
+	unsigned int cache_size = 16384; // page cache per connection, in KiB
+	unsigned long long mmap_size = 256ull << 20; // bytes of the file to map
+	unsigned int busy_timeout = 5000; // ms to wait on a locked database
+
+	unsigned int session_ttl = 3600; // seconds a verifyacc token stays valid
+
+	// Password hashing, done on its own threads so logins can't hold up the rest
+	unsigned int hash_cost = 14; // scrypt N as a power of two, 14 takes ~16 MiB and tens of ms
+	unsigned int hash_threads = 0; // 0 means half the request threads
+	unsigned int hash_queue = 1024; // requests waiting on a hash before new ones are turned away
+
+	// Group commit: writes are queued and committed together in one transaction
+	unsigned int batch_size = 64; // most writes in one batch
+	unsigned int batch_window = 2000; // µs the first write of a batch waits for others
+
+	// Response compression, when the client accepts gzip or deflate
+	unsigned int compress_min = 1024; // bytes, smaller bodies are sent as they are
+	int compress_level = 6; // zlib level, 1 is fastest and 9 smallest
+	unsigned int compress_cache = 1024; // compressed bodies kept for responses with an ETag, 0 turns it off (rounded up to a multiple of 16)
+
+	// Request tracing, off unless one of the first two is set
+	double trace_rate = 0; // share of requests traced, 0 to 1
+	unsigned int trace_slow = 0; // µs, requests at least this slow are always kept, 0 turns it off
+	unsigned int trace_buffer = 1024; // traced requests kept per thread
+};
+
+extern Config config;
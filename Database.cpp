@@ -0,0 +1,184 @@
+#include "Database.h"
+#include "Config.h"
+
+ConnectionPool dbWriter;
+ConnectionPool dbReaders;
+
+static uint64_t nanosSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * Opens a connection to the database and applies the tuning pragmas from
+ * the config. Requests are served from several threads, so wait on a
+ * locked database rather than failing right away.
+ *
+ * The read-write connection also switches the database to WAL, which is
+ * stored in the file and picked up by every other connection.
+ */
+int dbOpen(const char *path, sqlite3 **db, bool readOnly) {
+	int flags = readOnly ? SQLITE_OPEN_READONLY : (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+	int rc = sqlite3_open_v2(path, db, flags | SQLITE_OPEN_NOMUTEX, nullptr);
+	if (rc != SQLITE_OK) return rc;
+
+	sqlite3_busy_timeout(*db, config.busy_timeout);
+
+	std::string pragmas =
+		"PRAGMA synchronous = " + config.synchronous + ";"
+		"PRAGMA cache_size = -" + std::to_string(config.cache_size) + ";"
+		"PRAGMA mmap_size = " + std::to_string(config.mmap_size) + ";"
+		"PRAGMA temp_store = MEMORY;";
+	if (!readOnly) pragmas = "PRAGMA journal_mode = WAL;" + pragmas;
+
+	char *errMsg = nullptr;
+	rc = sqlite3_exec(*db, pragmas.c_str(), nullptr, nullptr, &errMsg);
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error applying pragmas: " << errMsg << "\n";
+		sqlite3_free(errMsg);
+	}
+	return rc;
+}
+
+//################################################
+// statement cache
+
+void Connection::finalizeStatements() {
+	for (auto &cached : statements) {
+		sqlite3_finalize(cached.stmt);
+		cached.stmt = nullptr;
+	}
+}
+
+Statement::Statement(Connection &conn, Stmt id) {
+	auto &cached = conn.statements[(int)id];
+
+	if (cached.busy) {
+		// Already handed out, use a throwaway copy
+		auto start = std::chrono::steady_clock::now();
+		sqlite3_prepare_v2(conn.db, statementSql[(int)id], -1, &stmt, nullptr);
+		metrics.sqlTime(Metrics::Sql::Prepare, nanosSince(start));
+		return;
+	}
+
+	if (cached.stmt) {
+		conn.cacheHits.fetch_add(1, std::memory_order_relaxed);
+	} else {
+		conn.cacheMisses.fetch_add(1, std::memory_order_relaxed);
+		auto start = std::chrono::steady_clock::now();
+		int rc = sqlite3_prepare_v3(conn.db, statementSql[(int)id], -1, SQLITE_PREPARE_PERSISTENT, &cached.stmt, nullptr);
+		metrics.sqlTime(Metrics::Sql::Prepare, nanosSince(start));
+		if (rc != SQLITE_OK) {
+			std::cerr << "Error preparing statement: " << sqlite3_errmsg(conn.db) << "\n";
+			sqlite3_finalize(cached.stmt);
+			cached.stmt = nullptr;
+			return;
+		}
+	}
+
+	cached.busy = true;
+	slot = &cached;
+	stmt = cached.stmt;
+}
+
+Statement::~Statement() {
+	auto start = std::chrono::steady_clock::now();
+	if (!slot) {
+		sqlite3_finalize(stmt);
+	} else {
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+		slot->busy = false;
+	}
+	metrics.sqlTime(Metrics::Sql::Finalize, nanosSince(start));
+}
+
+//################################################
+// transactions
+
+Transaction::Transaction(Connection &conn) : conn(conn) {
+	nested = !sqlite3_get_autocommit(conn.db);
+	Statement begin(conn, nested ? Stmt::Savepoint : Stmt::Begin);
+	open = begin && begin.step() == SQLITE_DONE;
+}
+
+Transaction::~Transaction() {
+	if (!open) return;
+	if (nested) {
+		Statement rollback(conn, Stmt::RollbackToSavepoint);
+		if (rollback) rollback.step();
+		Statement release(conn, Stmt::ReleaseSavepoint);
+		if (release) release.step();
+		return;
+	}
+	Statement rollback(conn, Stmt::Rollback);
+	if (rollback) rollback.step();
+}
+
+bool Transaction::commit() {
+	if (!open) return(false);
+	Statement commit(conn, nested ? Stmt::ReleaseSavepoint : Stmt::Commit);
+	if (!commit || commit.step() != SQLITE_DONE) return(false);
+	open = false;
+	return(true);
+}
+
+//################################################
+// connection pool
+
+bool ConnectionPool::open(const char *path, unsigned int size, bool readOnly) {
+	std::lock_guard<std::mutex> guard(lock);
+
+	for (unsigned int i = 0; i < size; i++) {
+		auto conn = std::make_unique<Connection>();
+		if (dbOpen(path, &conn->db, readOnly) != SQLITE_OK) {
+			std::cerr << "Can't open database: " << sqlite3_errmsg(conn->db) << "\n";
+			sqlite3_close(conn->db);
+			return(false);
+		}
+		idle.push_back(conn.get());
+		connections.push_back(std::move(conn));
+	}
+	return(true);
+}
+
+void ConnectionPool::close() {
+	std::lock_guard<std::mutex> guard(lock);
+
+	for (auto &conn : connections) {
+		conn->finalizeStatements();
+		sqlite3_close(conn->db);
+	}
+	connections.clear();
+	idle.clear();
+}
+
+ConnectionPool::Handle ConnectionPool::acquire() {
+	std::unique_lock<std::mutex> guard(lock);
+	available.wait(guard, [this] { return !idle.empty(); });
+
+	Connection *conn = idle.back();
+	idle.pop_back();
+	return Handle(this, conn);
+}
+
+void ConnectionPool::release(Connection *conn) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		idle.push_back(conn);
+	}
+	available.notify_one();
+}
+
+uint64_t ConnectionPool::cacheHits() {
+	std::lock_guard<std::mutex> guard(lock);
+	uint64_t total = 0;
+	for (auto &conn : connections) total += conn->cacheHits.load(std::memory_order_relaxed);
+	return total;
+}
+
+uint64_t ConnectionPool::cacheMisses() {
+	std::lock_guard<std::mutex> guard(lock);
+	uint64_t total = 0;
+	for (auto &conn : connections) total += conn->cacheMisses.load(std::memory_order_relaxed);
+	return total;
+}
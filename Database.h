@@ -0,0 +1,141 @@
+#pragma once
+#include "Util.h"
+#include "Statements.h"
+#include "Metrics.h"
+
+/*
+ * A long-lived connection to the database. Connections are owned by the
+ * ConnectionPool and lent out to one request at a time.
+ *
+ * Compiled statements are cached per connection, one slot per Stmt.
+ * A slot is marked busy while a Statement holds it.
+ */
+struct Connection {
+	struct CachedStatement {
+		sqlite3_stmt *stmt = nullptr;
+		bool busy = false;
+	};
+
+	sqlite3 *db = nullptr;
+	CachedStatement statements[(int)Stmt::Count];
+
+	// Bumped by Statement, read by whoever reports them
+	std::atomic<uint64_t> cacheHits{0};
+	std::atomic<uint64_t> cacheMisses{0};
+
+	void finalizeStatements();
+};
+
+/*
+ * A statement borrowed from the connection's cache for one use. Prepares the
+ * SQL on first use; on destruction the statement is reset and its bindings
+ * cleared so it is ready for the next request.
+ *
+ * If the cached copy is already in use further up the stack, a private copy
+ * is prepared instead and finalized afterwards.
+ */
+class Statement {
+	Connection::CachedStatement *slot = nullptr;
+	sqlite3_stmt *stmt = nullptr;
+
+public:
+	Statement(Connection &conn, Stmt id);
+	~Statement();
+	Statement(const Statement&) = delete;
+	Statement &operator=(const Statement&) = delete;
+
+	explicit operator bool() const { return stmt != nullptr; }
+	operator sqlite3_stmt*() const { return stmt; }
+
+	int step() { return timedStep(stmt); }
+
+	// Binds text without copying it, so it has to outlive this Statement
+	int bind(int index, std::string_view text) {
+		return sqlite3_bind_text(stmt, index, text.data(), (int)text.size(), SQLITE_STATIC);
+	}
+	// Same, but binds NULL when there is no value
+	int bindOptional(int index, std::optional<std::string_view> text) {
+		return text ? bind(index, *text) : sqlite3_bind_null(stmt, index);
+	}
+	// For temporaries
+	int bindCopy(int index, std::string_view text) {
+		return sqlite3_bind_text(stmt, index, text.data(), (int)text.size(), SQLITE_TRANSIENT);
+	}
+};
+
+/*
+ * A write transaction on one connection. Begins on construction and rolls
+ * back on destruction unless commit() went through, so an early return
+ * from a handler never leaves half a change behind.
+ *
+ * Opened while the connection is already in a transaction it becomes a
+ * savepoint, and commit() only makes it part of the outer transaction.
+ */
+class Transaction {
+	Connection &conn;
+	bool open = false;
+	bool nested = false;
+
+public:
+	explicit Transaction(Connection &conn);
+	~Transaction();
+	Transaction(const Transaction&) = delete;
+	Transaction &operator=(const Transaction&) = delete;
+
+	// False if BEGIN failed
+	explicit operator bool() const { return open; }
+	bool commit();
+};
+
+/*
+ * Fixed set of connections opened once at startup. Requests check a
+ * connection out with acquire() and the returned Handle puts it back when
+ * it goes out of scope, whichever way the handler returns. acquire() waits
+ * while none are free, so a pool is sized for every thread that may hold
+ * one at once.
+ *
+ * The backend keeps two of these: dbWriter holds the single read-write
+ * connection every mutating action queues up for, dbReaders holds the
+ * read-only connections that queries use. With the database in WAL mode
+ * readers keep working from the last commit while a write is in progress.
+ */
+class ConnectionPool {
+	std::mutex lock;
+	std::condition_variable available;
+	std::vector<std::unique_ptr<Connection>> connections;
+	std::vector<Connection*> idle;
+
+public:
+	class Handle {
+		ConnectionPool *pool;
+		Connection *conn;
+
+	public:
+		Handle(ConnectionPool *pool, Connection *conn) : pool(pool), conn(conn) {}
+		Handle(Handle &&other) : pool(other.pool), conn(std::exchange(other.conn, nullptr)) {}
+		Handle(const Handle&) = delete;
+		Handle &operator=(const Handle&) = delete;
+		~Handle() { if (conn) pool->release(conn); }
+
+		Connection &operator*() { return *conn; }
+		Connection *operator->() { return conn; }
+	};
+
+	~ConnectionPool() { close(); }
+
+	bool open(const char *path, unsigned int size, bool readOnly);
+	void close();
+	Handle acquire();
+
+	// Statement cache counters summed over every connection
+	uint64_t cacheHits();
+	uint64_t cacheMisses();
+
+private:
+	void release(Connection *conn);
+};
+
+extern ConnectionPool dbWriter;
+extern ConnectionPool dbReaders;
+
+int dbOpen(const char *path, sqlite3 **db, bool readOnly);
@@ -0,0 +1,111 @@
+#include "Json.h"
+#include "Metrics.h"
+#include <charconv>
+
+JsonWriter &JsonWriter::key(std::string_view name) {
+	separate();
+	writeString(name);
+	out += ':';
+	afterKey = true;
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(std::string_view text) {
+	separate();
+	writeString(text);
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(int64_t number) {
+	separate();
+	char buf[24];
+	auto end = std::to_chars(buf, buf + sizeof(buf), number).ptr;
+	out.append(buf, end - buf);
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(uint64_t number) {
+	separate();
+	char buf[24];
+	auto end = std::to_chars(buf, buf + sizeof(buf), number).ptr;
+	out.append(buf, end - buf);
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(double number) {
+	// JSON has no NaN or infinity
+	if (!std::isfinite(number)) return null();
+
+	separate();
+	char buf[32];
+	auto end = std::to_chars(buf, buf + sizeof(buf), number).ptr;
+	out.append(buf, end - buf);
+	return *this;
+}
+
+JsonWriter &JsonWriter::row(sqlite3_stmt *stmt) {
+	beginObject();
+	int columns = sqlite3_column_count(stmt);
+	for (int i = 0; i < columns; i++) {
+		key(sqlite3_column_name(stmt, i));
+		switch (sqlite3_column_type(stmt, i)) {
+			case SQLITE_INTEGER:
+				value((int64_t)sqlite3_column_int64(stmt, i));
+				break;
+			case SQLITE_FLOAT:
+				value(sqlite3_column_double(stmt, i));
+				break;
+			case SQLITE_NULL:
+				null();
+				break;
+			default: {
+				const char *text = (const char*)sqlite3_column_text(stmt, i);
+				value(std::string_view(text, sqlite3_column_bytes(stmt, i)));
+				break;
+			}
+		}
+	}
+	return endObject();
+}
+
+JsonWriter &JsonWriter::rows(sqlite3_stmt *stmt) {
+	beginArray();
+	do {
+		row(stmt);
+	} while (timedStep(stmt) == SQLITE_ROW);
+	return endArray();
+}
+
+/*
+ * Copies runs of plain characters in one go and only stops for the ones
+ * JSON needs escaped.
+ */
+void JsonWriter::writeString(std::string_view text) {
+	static const char hex[] = "0123456789abcdef";
+
+	out += '"';
+	size_t run = 0;
+	for (size_t i = 0; i < text.size(); i++) {
+		unsigned char c = text[i];
+		if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+		out.append(text.data() + run, i - run);
+		run = i + 1;
+		switch (c) {
+			case '"':  out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			case '\b': out += "\\b"; break;
+			case '\f': out += "\\f"; break;
+			default:
+				out += "\\u00";
+				out += hex[c >> 4];
+				out += hex[c & 0xf];
+				break;
+		}
+	}
+	out.append(text.data() + run, text.size() - run);
+	out += '"';
+}
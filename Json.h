@@ -0,0 +1,63 @@
+#pragma once
+#include "Util.h"
+
+/*
+ * Streaming JSON writer. Everything is appended to one string that is
+ * reserved up front, commas and escaping are handled here so handlers only
+ * say what goes in the document.
+ *
+ *   JsonWriter json;
+ *   json.beginObject().field("request", "0").key("movies").rows(stmt).endObject();
+ *   return json.take();
+ *
+ * Calls don't check that the document is well formed, keep begin/end paired.
+ */
+class JsonWriter {
+	std::string out;
+	bool first = true;     // nothing written yet at this nesting level
+	bool afterKey = false; // a key was just written, the value needs no comma
+
+public:
+	explicit JsonWriter(size_t reserve = 256) { out.reserve(reserve); }
+
+	JsonWriter &beginObject() { separate(); out += '{'; first = true; return *this; }
+	JsonWriter &endObject() { out += '}'; first = false; return *this; }
+	JsonWriter &beginArray() { separate(); out += '['; first = true; return *this; }
+	JsonWriter &endArray() { out += ']'; first = false; return *this; }
+
+	JsonWriter &key(std::string_view name);
+
+	JsonWriter &value(std::string_view text);
+	JsonWriter &value(const char *text) { return value(std::string_view(text)); }
+	JsonWriter &value(int64_t number);
+	JsonWriter &value(int number) { return value((int64_t)number); }
+	JsonWriter &value(uint64_t number);
+	JsonWriter &value(double number);
+	JsonWriter &null() { separate(); out += "null"; return *this; }
+
+	template<typename T>
+	JsonWriter &field(std::string_view name, T &&val) { key(name); return value(std::forward<T>(val)); }
+
+	// The current row of stmt as an object keyed by column name
+	JsonWriter &row(sqlite3_stmt *stmt);
+	// The current row and every row after it, as an array of objects.
+	// stmt must already have returned SQLITE_ROW from sqlite3_step().
+	JsonWriter &rows(sqlite3_stmt *stmt);
+
+	// Copies a value already encoded as JSON straight into the output
+	JsonWriter &raw(std::string_view json) { separate(); out += json; return *this; }
+
+	const std::string &str() const { return out; }
+	std::string take() { return std::move(out); }
+
+private:
+	void separate() {
+		if (afterKey) {
+			afterKey = false;
+			return;
+		}
+		if (!first) out += ',';
+		first = false;
+	}
+	void writeString(std::string_view text);
+};
@@ -4,94 +4,518 @@
 #include <sqlite3.h>
 #include <string>
 
-// Just to make things easier to change in the future
-#define DATABASE_FILE "movie_ticket_system.db"
-#define PORT 4444
+Config config;
+
+static int sqLiteCallback(void *NotUsed, int argc, char **argv, char **azColName);
+static int makeDefaultAdmin(sqlite3 *db);
 
 //################################################
 // handling requests
 
-std::unordered_map<std::string,std::function<std::string(std::map<std::string, std::string> params)>> requestTable = {
-	{"createacc",	    createAcc},
-	{"delacc",	        deleteAcc},
-	{"buyticket",	    buyTicket},
-	{"getticket",	    getTicket},
-	{"adminadd",	    adminAdd},
-	{"admindel",	    adminDel},
-	{"addmovie",	    addMovie},
-	{"delmovie",	    delMovie},
-	{"accdetails",	    accDetails},
-	{"listmovies",	    listMovies},
-	{"verifyacc",	    verifyAcc},
-	{"getmovie",	    getMovie},
-	{"checkadmin",	    adminVerify},
-	{"reviewadd",	    reviewAdd},
-	{"reviewlist",      reviewList},
-	{"addtheater",      addTheater},
-	{"deltheater",      delTheater},
-	{"gettheater",      getTheater},
-	{"genreport",       genReport},
-	{"updatepayment",   updatePayment}
+/*
+ * Every action the API understands. readOnly actions run on the reader
+ * connections, or on none when needsConnection is false, everything else
+ * queues for the writer. required lists the parameters handleRequest
+ * checks for before the handler is called, and tables the ones a read
+ * depends on or a write changes (see Versions.h).
+ */
+static constexpr Action actions[] = {
+	// createacc's password is hashed before the insert is queued, see runAction
+	{"createacc",     createAcc,     false, true,  Auth::None,  {"email", "password", "name"}},
+	{"delacc",        deleteAcc,     false, true,  Auth::User,  {}},
+	{"buyticket",     buyTicket,     false, true,  Auth::User,  {"ticket_amount", "movie_id"}, Tables::Seats},
+	{"getticket",     getTicket,     true,  true,  Auth::User,  {}},
+	{"adminadd",      adminAdd,      false, true,  Auth::Admin, {"target"}},
+	{"admindel",      adminDel,      false, true,  Auth::Admin, {"target"}},
+	{"addmovie",      addMovie,      false, true,  Auth::Admin, {"movie_name", "showtime", "price", "rating", "theater_id"}, Tables::Catalog | Tables::Seats},
+	{"delmovie",      delMovie,      false, true,  Auth::Admin, {"movie_id"}, Tables::Catalog | Tables::Seats},
+	{"accdetails",    accDetails,    true,  true,  Auth::User,  {}},
+	{"listmovies",    listMovies,    true,  false, Auth::None,  {}, Tables::Catalog},
+	{"verifyacc",     verifyAcc,     true,  false, Auth::Login, {"email", "password"}},
+	{"logout",        logout,        true,  false, Auth::User,  {"token"}},
+	{"getmovie",      getMovie,      true,  false, Auth::None,  {"movie_id"}, Tables::Catalog | Tables::Seats},
+	{"checkadmin",    adminVerify,   true,  false, Auth::User,  {}},
+	{"reviewadd",     reviewAdd,     false, true,  Auth::User,  {"movie_id", "review"}, Tables::Reviews},
+	{"reviewlist",    reviewList,    true,  true,  Auth::None,  {"movie_id"}, Tables::Reviews},
+	{"search",        search,        true,  true,  Auth::None,  {"q"}, Tables::Catalog | Tables::Reviews},
+	{"addtheater",    addTheater,    false, true,  Auth::Admin, {"theater_name"}, Tables::Catalog},
+	{"deltheater",    delTheater,    false, true,  Auth::Admin, {"theater_id"}, Tables::Catalog},
+	{"gettheater",    getTheater,    true,  false, Auth::None,  {"theater_name"}, Tables::Catalog},
+	{"genreport",     genReport,     true,  true,  Auth::Admin, {}},
+	{"updatepayment", updatePayment, false, true,  Auth::User,  {}},
+	{"stats",         serverStats,   true,  false, Auth::Admin, {}},
+	{"trace",         traceDump,     true,  false, Auth::Admin, {}},
+};
+static constexpr size_t actionCount = sizeof(actions) / sizeof(actions[0]);
+
+/*
+ * Perfect hash over the action names, worked out by the compiler. FNV-1a
+ * with a seed, bumping the seed until every name lands in its own slot.
+ * Looking an action up is one hash, one slot read and one compare.
+ */
+static constexpr size_t actionSlotCount = 128;
+static_assert(actionCount < 255, "slots store action index + 1 in a byte");
+
+static constexpr uint32_t actionHash(std::string_view name, uint32_t seed) {
+	uint32_t hash = 2166136261u ^ seed;
+	for (char c : name) {
+		hash ^= (uint8_t)c;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static constexpr bool actionSeedWorks(uint32_t seed) {
+	bool used[actionSlotCount] = {};
+	for (const Action &action : actions) {
+		size_t slot = actionHash(action.name, seed) % actionSlotCount;
+		if (used[slot]) return false;
+		used[slot] = true;
+	}
+	return true;
+}
+
+static constexpr uint32_t findActionSeed() {
+	for (uint32_t seed = 0; seed < 10000; seed++)
+		if (actionSeedWorks(seed)) return seed;
+	return UINT32_MAX;
+}
+
+static constexpr uint32_t actionSeed = findActionSeed();
+static_assert(actionSeed != UINT32_MAX, "no collision-free seed, grow actionSlotCount");
+
+struct ActionSlots {
+	uint8_t index[actionSlotCount] = {}; // 0 is empty, otherwise action index + 1
 };
 
-std::map<std::string, std::string> parseQuery(const std::string& query) {
-	std::map<std::string, std::string> params;
-	std::stringstream ss(query);
-	std::string item;
-
-	while (std::getline(ss, item, '&')) {
-		size_t pos = item.find('=');
-		if (pos != std::string::npos) {
-			std::string key = item.substr(0, pos);
-			std::string value = item.substr(pos + 1);
-			params[key] = value;
+static constexpr ActionSlots buildActionSlots() {
+	ActionSlots slots;
+	for (size_t i = 0; i < actionCount; i++)
+		slots.index[actionHash(actions[i].name, actionSeed) % actionSlotCount] = (uint8_t)(i + 1);
+	return slots;
+}
+
+static constexpr ActionSlots actionSlots = buildActionSlots();
+
+const Action *findAction(std::string_view name) {
+	uint8_t index = actionSlots.index[actionHash(name, actionSeed) % actionSlotCount];
+	if (!index || actions[index - 1].name != name) return nullptr;
+	return &actions[index - 1];
+}
+
+/*
+ * Returns an error body naming every required field if any are missing,
+ * or an empty string if the request has them all.
+ */
+static std::string missingFields(const Action &action, const QueryParams &params) {
+	bool missing = false;
+	for (std::string_view field : action.required) {
+		if (!field.empty() && !params.count(field)) missing = true;
+	}
+	if (!missing) return "";
+
+	std::string message = "Missing fields: Needs ";
+	for (std::string_view field : action.required) {
+		if (field.empty()) break;
+		if (message.back() == '\'') message += ", ";
+		message += '\'';
+		message += field;
+		message += '\'';
+	}
+	JsonWriter json;
+	json.beginObject().field("request", "1").field("message", message).endObject();
+	return json.take();
+}
+
+/*
+ * Works out who the request is for: a session token if it has one and
+ * the action takes tokens, otherwise its email and password. Returns an
+ * error body if neither checks out, or an empty string with caller filled in.
+ *
+ * Checking a password is slow, so this must not run on a network thread
+ * (see usesPasswordHash). No connection is held while the hash is worked
+ * out, the stored hash is fetched first and the reader given back.
+ */
+static std::string authenticate(const Action &action, const QueryParams &params, Caller &caller) {
+	auto token = params.get("token");
+	if (token && action.auth != Auth::Login) {
+		auto user_id = sessions.find(*token);
+		if (!user_id) return "{\"request\": \"1\", \"message\": \"Session expired or invalid.\"}";
+		caller.user_id = *user_id;
+		caller.admin = admins.contains(caller.user_id);
+		return "";
+	}
+
+	if (!params.count("email") || !params.count("password"))
+		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs 'token', or 'email', 'password'\"}";
+
+	std::string stored;
+	bool found = false;
+	{
+		auto conn = dbReaders.acquire();
+		Statement stmt(*conn, Stmt::Authenticate);
+		if (!stmt) return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
+
+		stmt.bind(1, params["email"]);
+		if (stmt.step() == SQLITE_ROW) {
+			found = true;
+			caller.user_id = sqlite3_column_int64(stmt, 0);
+			const char *password = (const char*)sqlite3_column_text(stmt, 1);
+			if (password) stored.assign(password, sqlite3_column_bytes(stmt, 1));
+		}
+	}
+
+	// An unknown email takes as long to turn away as a wrong password
+	if (!found) {
+		verifyNoPassword(params["password"]);
+		return "{\"request\": \"1\", \"message\": \"Invalid email or password.\"}";
+	}
+
+	if (!verifyPassword(params["password"], stored))
+		return "{\"request\": \"1\", \"message\": \"Invalid email or password.\"}";
+	caller.admin = admins.contains(caller.user_id);
+
+	// Accounts from before passwords were hashed get upgraded on their next login
+	if (!isPasswordHash(stored)) {
+		std::string hash = hashPassword(params["password"]);
+		if (!hash.empty()) {
+			writePipeline.submit([hash, user_id = caller.user_id](Connection &conn) {
+				Statement stmt(conn, Stmt::UpdatePassword);
+				if (stmt) {
+					stmt.bind(1, hash);
+					sqlite3_bind_int64(stmt, 2, user_id);
+					stmt.step();
+				}
+				return std::string();
+			}, nullptr);
+		}
+	}
+	return "";
+}
+
+/*
+ * Whether the request has to hash a password before it can be answered:
+ * creating an account, or logging in with email/password instead of a token.
+ */
+static bool usesPasswordHash(const Action &action, const QueryParams &params) {
+	if (action.handler == createAcc) return(true);
+	if (action.auth == Auth::Login) return(true);
+	return action.auth != Auth::None && !params.count("token");
+}
+
+static std::string_view queryString(const http::request<http::string_body> &req) {
+	std::string_view target(req.target().data(), req.target().size());
+	size_t pos = target.find('?');
+	return pos == std::string_view::npos ? std::string_view() : target.substr(pos + 1);
+}
+
+using Reply = std::function<void(std::string body)>;
+
+// Given to handlers that don't need a connection, it has no database open
+static Connection noConnection;
+
+/*
+ * buyticket's answer if the seat ledger already rules the purchase out,
+ * empty if it may go through. Bad ids are left for buyTicket to report.
+ */
+static std::string seatsRuledOut(const QueryParams &params) {
+	auto movie_id = parseId(params["movie_id"]);
+	auto quantity = parseId(params["ticket_amount"]);
+	if (!movie_id || !quantity || *quantity < 1) return std::string();
+
+	auto left = seats.remaining(*movie_id);
+	if (!left) return "{\"request\": \"1\", \"message\": \"Invalid movie id\"}";
+	if (*left < *quantity) return "{\"request\": \"1\", \"message\": \"Not enough seats left.\"}";
+	return std::string();
+}
+
+/*
+ * Checks the login if the action needs one, then runs its handler. Reads
+ * borrow a reader and reply straight away. Writes are queued on the write
+ * pipeline and reply on an io thread once their batch has committed, so
+ * the thread calling this never waits on the writer.
+ */
+static void runAction(const http::request<http::string_body> &req, const Action &action, const QueryParams &params, Reply reply, RequestTrace *trace) {
+	Caller caller;
+	if (action.auth != Auth::None) {
+		trace->begin(Stage::Auth);
+		std::string error = authenticate(action, params, caller);
+		trace->end(Stage::Auth);
+		if (!error.empty()) return reply(std::move(error));
+		if (action.auth == Auth::Admin && !caller.admin)
+			return reply("{\"request\": \"1\", \"message\": \"Permission denied.\"}");
+	}
+
+	// A new account's password is hashed here, on the hashing thread, so
+	// neither a reader nor the writer is held while scrypt runs
+	if (action.handler == createAcc) {
+		trace->begin(Stage::Hash);
+		caller.passwordHash = hashPassword(params["password"]);
+		trace->end(Stage::Hash);
+		if (caller.passwordHash.empty())
+			return reply("{\"request\": \"1\", \"message\": \"Failed to create account.\"}");
+	}
+
+	if (action.readOnly) {
+		// Handlers borrow a pooled connection for the length of the request,
+		// unless all they read is in memory
+		std::optional<ConnectionPool::Handle> conn;
+		if (action.needsConnection) conn.emplace(dbReaders.acquire());
+		trace->begin(Stage::Handler);
+		handlerTrace = trace->active ? trace : nullptr;
+		std::string body = action.handler(conn ? **conn : noConnection, params, caller);
+		handlerTrace = nullptr;
+		trace->end(Stage::Handler);
+		return reply(std::move(body));
+	}
+
+	// A sold-out showing is answered from the ledger, it never costs the
+	// writer a job. buyTicket still reserves for real, seats may go meanwhile.
+	if (action.handler == buyTicket) {
+		std::string refused = seatsRuledOut(params);
+		if (!refused.empty()) return reply(std::move(refused));
+	}
+
+	if (trace->active) {
+		reply = [reply = std::move(reply), trace](std::string body) {
+			trace->end(Stage::Commit);
+			reply(std::move(body));
+		};
+	}
+
+	// params can't be carried over to the pipeline thread, it parses its own from req
+	trace->begin(Stage::WriteQueue);
+	writePipeline.submit([&req, &action, caller, trace](Connection &conn) {
+		trace->end(Stage::WriteQueue);
+		trace->begin(Stage::Handler);
+		handlerTrace = trace->active ? trace : nullptr;
+		QueryParams params(queryString(req));
+		std::string body = action.handler(conn, params, caller);
+		handlerTrace = nullptr;
+		trace->end(Stage::Handler);
+		// Reads tagged before this see their tags go stale, but only once
+		// the batch has committed
+		if (action.tables) {
+			writePipeline.afterCommit([tables = action.tables](Connection &) { tableVersions.bump(tables); });
 		}
+		trace->begin(Stage::Commit);
+		return body;
+	}, std::move(reply));
+}
+
+/*
+ * True if an If-None-Match header names etag. The header is a comma
+ * separated list of tags, any of which may be weak, or "*". A "*" never
+ * matches: the tag is worked out before the handler runs, so it can't
+ * tell whether there is anything there (getmovie for a missing id).
+ */
+static bool etagMatches(std::string_view header, std::string_view etag) {
+	while (!header.empty()) {
+		size_t comma = header.find(',');
+		std::string_view tag = header.substr(0, comma);
+		header.remove_prefix(comma == std::string_view::npos ? header.size() : comma + 1);
+
+		while (!tag.empty() && tag.front() == ' ') tag.remove_prefix(1);
+		while (!tag.empty() && tag.back() == ' ') tag.remove_suffix(1);
+		if (tag.substr(0, 2) == "W/") tag.remove_prefix(2);
+		if (tag == etag) return(true);
+	}
+	return(false);
+}
+
+static std::atomic<uint64_t> notModified{0};
+
+static bool fromBrowser(const http::request<http::string_body> &req) {
+	std::string userAgent(req[http::field::user_agent].begin(), req[http::field::user_agent].end());
+	return userAgent.find("Mozilla") != std::string::npos ||
+		userAgent.find("Chrome") != std::string::npos ||
+		userAgent.find("Safari") != std::string::npos;
+}
+
+static Encoding acceptedEncoding(const http::request<http::string_body> &req) {
+	auto accept = req[http::field::accept_encoding];
+	return negotiateEncoding(std::string_view(accept.data(), accept.size()));
+}
+
+// Headers and body for a JSON response already encoded as encoding
+static void sendBody(http::response<http::string_body>& res, std::string body, Encoding encoding) {
+	res.result(http::status::ok);
+	res.set(http::field::content_type, "application/json");
+	res.set(http::field::vary, "Accept-Encoding");
+	if (encoding != Encoding::Identity) res.set(http::field::content_encoding, std::string(encodingName(encoding)));
+	res.body() = std::move(body);
+	res.prepare_payload();
+}
+
+/*
+ * Fills in res with body, compressed if the client takes it and it is
+ * big enough to be worth it. Returns the encoding that was used.
+ */
+static Encoding respond(const http::request<http::string_body> &req, http::response<http::string_body>& res, std::string body) {
+	if (fromBrowser(req)) {
+		body = "{\"request\": \"1\", \"message\": \"Get the hell out of the browser loser.\"}";
 	}
 
-	return params;
+	Encoding encoding = body.size() >= config.compress_min ? acceptedEncoding(req) : Encoding::Identity;
+	if (encoding != Encoding::Identity) {
+		std::string packed;
+		if (compressBody(body, encoding, packed)) body = std::move(packed);
+		else encoding = Encoding::Identity;
+	}
+	sendBody(res, std::move(body), encoding);
+	return encoding;
+}
+
+// Anything that isn't {"request": "0", ...} counts as a failure in /metrics
+static bool failedBody(const std::string &body) {
+	static const char compact[] = "{\"request\":\"0\"", spaced[] = "{\"request\": \"0\"";
+	return body.compare(0, sizeof(compact) - 1, compact) != 0 && body.compare(0, sizeof(spaced) - 1, spaced) != 0;
+}
+
+// Requests with no action, or one that doesn't exist, are counted under this
+static constexpr size_t unknownAction = actionCount;
+static_assert(unknownAction < Metrics::maxActions, "grow Metrics::maxActions");
+
+static void sendMetrics(http::response<http::string_body>& res) {
+	std::vector<std::string_view> names;
+	for (const Action &action : actions) names.push_back(action.name);
+	names.push_back("unknown");
+
+	res.result(http::status::ok);
+	res.set(http::field::content_type, "text/plain; version=0.0.4");
+	res.body() = metrics.render(names);
+	res.prepare_payload();
 }
 
-void handleRequest(http::request<http::string_body> req, http::response<http::string_body>& res) {
+// Stands in when the caller doesn't trace, never active so never written to
+static RequestTrace untraced;
+
+void handleRequest(const http::request<http::string_body> &req, http::response<http::string_body>& res, std::function<void()> done, RequestTrace *trace) {
+	if (!trace) trace = &untraced;
 	// response version
 	res.version(req.version());
 	// keep-alive settings
 	res.keep_alive(req.keep_alive());
 
-	std::string body;
+	std::string_view target(req.target().data(), req.target().size());
+	std::string_view path = target.substr(0, target.find('?'));
+
+	if (req.method() == http::verb::get && path == "/metrics") {
+		trace->label("/metrics");
+		sendMetrics(res);
+		return done();
+	}
+
+	auto started = std::chrono::steady_clock::now();
+	metrics.requestStarted();
+	trace->begin(Stage::Parse);
+
+	if (req.method() != http::verb::get) {
+		res.result(http::status::not_found);
+		res.set(http::field::content_type, "text/plain");
+		res.body() = "Not found";
+		res.prepare_payload();
+		metrics.requestFinished(unknownAction, true, started);
+		return done();
+	}
+
+	size_t metric = unknownAction;
+	std::string etag;
+	bool cacheable = false;
+
+	// Built once the action and its tag are known. The ETag is weak, it
+	// stands for the data whichever encoding it goes out in.
+	auto makeReply = [&req, &res, &done, &started, &metric, &etag, &cacheable, trace]() -> Reply {
+		return [&req, &res, done, started, metric, etag, cacheable, trace](std::string body) {
+			bool failed = failedBody(body);
+			trace->begin(Stage::Respond);
+			Encoding encoding = respond(req, res, std::move(body));
+			if (!etag.empty()) {
+				if (cacheable && encoding != Encoding::Identity) {
+					compressedCache.store(std::string_view(req.target().data(), req.target().size()), etag, encoding, res.body());
+				}
+				res.set(http::field::etag, "W/" + etag);
+			}
+			trace->end(Stage::Respond);
+			metrics.requestFinished(metric, failed, started);
+			done();
+		};
+	};
 
-	if (req.method() == http::verb::get) {
-		std::string target(req.target().begin(), req.target().end());
-		size_t pos = target.find('?');
+	std::string body;
 
-		if (pos != std::string::npos) {
-			std::string query = target.substr(pos + 1);
-			auto params = parseQuery(query);
+	if (target.find('?') != std::string_view::npos) {
+		// Views into req, which outlives the handler call
+		QueryParams params(queryString(req));
+
+		if(params.count("action")) {
+			const Action *action = findAction(params["action"]);
+			if (action) {
+				metric = action - actions;
+				trace->label(action->name);
+				body = missingFields(*action, params);
+				trace->end(Stage::Parse);
+
+				// Reads anyone may make can be answered from the client's copy if
+				// nothing they depend on has changed since it was sent
+				if (body.empty() && action->readOnly && action->auth == Auth::None && action->tables) {
+					etag = tableVersions.etag(action->tables, target);
+					auto ifNoneMatch = req[http::field::if_none_match];
+					if (!ifNoneMatch.empty() && etagMatches(std::string_view(ifNoneMatch.data(), ifNoneMatch.size()), etag)) {
+						notModified.fetch_add(1, std::memory_order_relaxed);
+						res.result(http::status::not_modified);
+						res.set(http::field::etag, "W/" + etag);
+						res.set(http::field::vary, "Accept-Encoding");
+						res.body().clear();
+						res.prepare_payload();
+						metrics.requestFinished(metric, false, started);
+						return done();
+					}
+
+					// Same target and tag, same body: one compressed earlier can be sent as it is
+					Encoding encoding = acceptedEncoding(req);
+					cacheable = encoding != Encoding::Identity && !fromBrowser(req);
+					if (cacheable) {
+						if (auto cached = compressedCache.find(target, etag, encoding)) {
+							sendBody(res, *cached, encoding);
+							res.set(http::field::etag, "W/" + etag);
+							metrics.requestFinished(metric, false, started);
+							return done();
+						}
+					}
+				}
 
-			if(params.find("action") != params.end()) {
-				try {
-					body = 	requestTable[params["action"]](params);
-				} catch (...) {
-					body = "{\"message\": \"INVALID ACTION: " + params["action"] + "\"}";
+				if (body.empty() && usesPasswordHash(*action, params)) {
+					// Off the network thread. req and res belong to the session,
+					// which done keeps alive until the response is written.
+					trace->begin(Stage::HashQueue);
+					bool queued = hashPool.submit([&req, action, reply = makeReply(), trace] {
+						trace->end(Stage::HashQueue);
+						QueryParams params(queryString(req));
+						runAction(req, *action, params, reply, trace);
+					});
+					if (queued) return;
+
+					respond(req, res, "{\"request\": \"1\", \"message\": \"Server busy, try again.\"}");
+					res.result(http::status::service_unavailable);
+					metrics.requestFinished(metric, true, started);
+					return done();
 				}
+				if (body.empty())
+					return runAction(req, *action, params, makeReply(), trace);
 			} else {
-				body = "{\"message\": \"err: NO ACTION\"}";
+				// The action name came from the client, let the writer escape it
+				JsonWriter json;
+				json.beginObject().field("message", "INVALID ACTION: " + std::string(params["action"])).endObject();
+				body = json.take();
 			}
+		} else {
+			body = "{\"message\": \"err: NO ACTION\"}";
 		}
-		std::string userAgent(req[http::field::user_agent].begin(), req[http::field::user_agent].end());
-		if (userAgent.find("Mozilla") != std::string::npos ||
-			userAgent.find("Chrome") != std::string::npos ||
-			userAgent.find("Safari") != std::string::npos) {
-			body = "{\"request\": \"1\", \"message\": \"Get the hell out of the browser loser.\"}";
-		}
-		res.result(http::status::ok);
-		res.set(http::field::content_type, "application/json");
-		res.body() = body;		
-	} else {
-		res.result(http::status::not_found);
-		res.set(http::field::content_type, "text/plain");
-		res.body() = "Not found";
 	}
-	res.prepare_payload();
+
+	trace->end(Stage::Parse);
+	makeReply()(std::move(body));
 }
 
 
@@ -118,127 +542,44 @@ bool sqLiteExecute(sqlite3 *db, const std::string &sql) {
 }
 
 int sqLiteInitialize() {
-	sqlite3 *db;
-	int rc = sqlite3_open(DATABASE_FILE, &db);
-	if (rc) {
-		std::cerr << "Can't open database: " << sqlite3_errmsg(db) << "\n";
+	// The writer goes first, it creates the file and puts it in WAL mode
+	if (!dbWriter.open(DATABASE_FILE, 1, false)) {
 		return(1);
 	} else {
 		std::cout << "Opened database successfully\n";
 	}
 
-	/*
-	 * Users:
-	 * - id (increases per user)
-	 * - name (can be whatever name they want.)
-	 * - email (can only happen once in the list)
-	 * - password (hashed. cannot be empty)
-	 * - payment details, although allow paying in person.
-	 */
-	std::string templateUsersTable = R"(
-		CREATE TABLE IF NOT EXISTS Users (
-			id INTEGER PRIMARY KEY AUTOINCREMENT,
-			name TEXT,
-			email TEXT NOT NULL UNIQUE,
-			password TEXT NOT NULL,
-			payment_details TEXT
-		);
-	)";
+	auto conn = dbWriter.acquire();
+	sqlite3 *db = conn->db;
 
-	/*
-	 * Movies:
-	 * - id (must be an int) (increments for each movie)
-	 * - name (text of the movie name)
-	 * - showtime (unix timestamp possibly?)
-	 * - price per ticket (deals, etc)
-	 * - rating (g, pg, pg13, etc...)
-	 */
-	std::string templateMoviesTable = R"(
-		CREATE TABLE IF NOT EXISTS Movies (
-			id INTEGER PRIMARY KEY AUTOINCREMENT,
-			name TEXT NOT NULL,
-			showtime TEXT NOT NULL,
-			price_per_ticket REAL NOT NULL,
-			rating TEXT CHECK (rating IN ('G', 'PG', 'PG13', 'R', 'NC17')) NOT NULL,
-            theater_id INTEGER NOT NULL,
-            FOREIGN KEY (theater_id) REFERENCES Theaters(id)
-		);
-	)";
+	// Brings the schema up to date, creating it on a fresh file
+	if (!runMigrations(db)) {
+		return(1);
+	}
 
-	/*
-	 * Tickets
-	 * - id (of ticket)
-	 * - userid (of person who bought it) (REFERENCES USER TABLE)
-	 * - movieid (REFERENCES MOVIE TABLE)
-	 * - quantity (of tickets bought)
-	 * - purchase time (time of rows creation)
-	 */
-	std::string templateTicketsTable = R"(
-		CREATE TABLE IF NOT EXISTS Tickets (
-			id INTEGER PRIMARY KEY AUTOINCREMENT,
-			user_id INTEGER NOT NULL,
-			movie_id INTEGER NOT NULL,
-			quantity INTEGER NOT NULL DEFAULT 1,
-			purchase_time TEXT NOT NULL DEFAULT (datetime('now')),
-			FOREIGN KEY (user_id) REFERENCES Users(id),
-			FOREIGN KEY (movie_id) REFERENCES Movies(id)
-		);
-	)";
-	
-	/*
-	 * Admins:
-	 * - id (of user that is admin) (REFERENCES USER TABLE)
-	 */ 
-	std::string templateAdminsTable = R"(
-		CREATE TABLE IF NOT EXISTS Admins (
-			user_id INTEGER PRIMARY KEY,
-			FOREIGN KEY (user_id) REFERENCES Users(id)
-		);
-	)";
+	std::cout << makeDefaultAdmin(db) << "\n";
+	std::cout << "Tables created successfully!\n";
 
-	/*
-	 * Reviews
-	 * - userid (of person who left the review) (REFERENCES USER TABLE)
-	 * - movieid (the movie the review is for) (REFERENCES MOVIE TABLE)
-	 * - review (the users review)
-	 */
-	std::string templateReviewTable = R"(
-		CREATE TABLE IF NOT EXISTS Reviews (
-			user_id INTEGER NOT NULL,
-			movie_id INTEGER NOT NULL,
-			review TEXT NOT NULL,
-            PRIMARY KEY (user_id, movie_id),
-			FOREIGN KEY (user_id) REFERENCES Users(id),
-			FOREIGN KEY (movie_id) REFERENCES Movies(id)
-		);
-	)";
+	// After makeDefaultAdmin, so the default admin is in the set
+	if (!admins.load(*conn)) {
+		std::cerr << "Can't load admins: " << sqlite3_errmsg(db) << "\n";
+		return(1);
+	}
 
-	/*
-	 * Theater:
-	 * - id (id of the theater)
-     * - name (the name of the theater)
-	 */ 
-	std::string templateTheaterTable = R"(
-		CREATE TABLE IF NOT EXISTS Theaters (
-			id INTEGER PRIMARY KEY AUTOINCREMENT,
-            name TEXT NOT NULL
-		);
-	)";
+	if (!seats.load(*conn)) {
+		std::cerr << "Can't load seats: " << sqlite3_errmsg(db) << "\n";
+		return(1);
+	}
 
-	if (!sqLiteExecute(db, templateUsersTable) ||
-		!sqLiteExecute(db, templateMoviesTable) ||
-		!sqLiteExecute(db, templateTicketsTable) ||
-		!sqLiteExecute(db, templateReviewTable) ||
-		!sqLiteExecute(db, templateTheaterTable) ||
-		!sqLiteExecute(db, templateAdminsTable)) {
-		sqlite3_close(db);
+	if (!catalog.reload(*conn)) {
+		std::cerr << "Can't load catalog: " << sqlite3_errmsg(db) << "\n";
 		return(1);
 	}
 
-	std::cout << makeDefaultAdmin(db) << "\n";
-	std::cout << "Tables created successfully!\n";
+	if (!dbReaders.open(DATABASE_FILE, config.db_connections, true)) {
+		return(1);
+	}
 
-	sqlite3_close(db);
 	return(0);
 }
 
@@ -258,6 +599,7 @@ static int makeDefaultAdmin(sqlite3 *db) {
 	sqlite3_finalize(stmt);
 
 	if (!adminExists) {
+		std::string hash = hashPassword(adminuser);
 		std::string insertUserSQL = R"(
 		INSERT INTO Users (name, email, password, payment_details)
 		VALUES (?, ?, ?, ?);
@@ -268,7 +610,7 @@ static int makeDefaultAdmin(sqlite3 *db) {
 	}
 	sqlite3_bind_text(stmt, 1, adminuser.c_str(), -1, SQLITE_TRANSIENT);
 	sqlite3_bind_text(stmt, 2, adminuser.c_str(), -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 3, adminuser.c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_text(stmt, 3, hash.c_str(), -1, SQLITE_TRANSIENT);
 	sqlite3_bind_text(stmt, 4, adminuser.c_str(), -1, SQLITE_TRANSIENT);
 	if (sqlite3_step(stmt) != SQLITE_DONE) {
 			std::cerr << "Error inserting admin user: " << sqlite3_errmsg(db) << "\n";
@@ -303,124 +645,92 @@ static int makeDefaultAdmin(sqlite3 *db) {
 // database addition
 
 /*
- * Requirements:
- * - stmt (must have sqlite3_step() called beforehand and checked if its result == SQLITE_ROW)
- *
- * Returns:
- * - 
+ * Starts the envelope every successful response shares. The caller adds
+ * its own fields and closes the object.
  */
-static inline std::string parseSelect(sqlite3_stmt* stmt) {
-    std::string entries = "[\n";
-    int j = 0;
-    do {
-        std::string row = "{ ";
-        char* col = NULL;
-        for(int i = 0 ; (col = ((char*)sqlite3_column_text(stmt,i))); i++) {
-            row += "\"" + std::string(sqlite3_column_name(stmt, i)) + "\":";
-            row += "\"" + std::string(col) + "\", ";
-        }
-        row[row.find_last_of(',')] = ' '; // Remove that last comma
-        entries += row + "},\n";
-    } while(sqlite3_step(stmt) == SQLITE_ROW);
-    entries[entries.find_last_of(',')] = ' '; // Remove that last comma
-    entries += "]";
-    return entries;
+static inline JsonWriter &success(JsonWriter &json, std::string_view message = "Success!") {
+    return json.beginObject().field("request", "0").field("message", message);
 }
 
 /*
- * Requirements:
- * - Email
- * - Password
- * - db (MUST BE OPENED BEFOREHAND!)
- *
- * Returns:
- * - bool
+ * Writes the rows of a paged query as an array under name, then "next" if
+ * another page follows. stmt must be on its first row and should have been
+ * asked for limit + 1 rows: the extra one is never written, it only shows
+ * that there is more. cursorOf makes the cursor from the last row written.
  */
-// Small internal function to cut down on rewriting things
-static inline bool isAdmin(std::string &email, std::string &password, sqlite3* db) {
-    if(!db) return false; // Check if the db exists
-    bool result = false;
-	sqlite3_stmt *admin_stmt = nullptr;
-
-    std::string admin_query = "SELECT CASE WHEN user_id = id THEN 1 WHEN user_id <> id THEN 0 END AS is_admin FROM Admins FULL JOIN Users WHERE email = ? AND password = ?";
-
-    if(sqlite3_prepare_v2(db, admin_query.c_str(), -1, &admin_stmt, nullptr)) {
-		sqlite3_close(db);
-        sqlite3_finalize(admin_stmt);
-		return false;
-    }
+static JsonWriter &pageRows(JsonWriter &json, std::string_view name, Statement &stmt, size_t limit,
+	std::string (*cursorOf)(sqlite3_stmt *row)) {
+	json.key(name).beginArray();
+	std::string next;
+	size_t count = 0;
+	int rc = SQLITE_ROW;
+	while (rc == SQLITE_ROW && count < limit) {
+		if (++count == limit) next = cursorOf(stmt);
+		json.row(stmt);
+		rc = stmt.step();
+	}
+	json.endArray();
+	if (rc == SQLITE_ROW) json.field("next", next);
+	return json;
+}
 
-    sqlite3_bind_text(admin_stmt, 1, email.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(admin_stmt, 2, password.c_str(), -1, SQLITE_TRANSIENT);
+// Cursor for queries paged on the integer id in their first column
+static std::string idCursor(sqlite3_stmt *row) {
+	return makeCursor({std::to_string(sqlite3_column_int64(row, 0))});
+}
 
-    if(sqlite3_step(admin_stmt) == SQLITE_ROW)
-        if(sqlite3_column_text(admin_stmt, 0)[0] == '1') result = true;
-    sqlite3_finalize(admin_stmt);
-    return result;
+/*
+ * Called by the handlers that change Movies or Theaters. The catalog is
+ * reloaded after the batch commits, so readers never see a change that is
+ * later rolled back. If the reload fails the old catalog stays up.
+ */
+static void refreshCatalog() {
+	writePipeline.afterCommit([](Connection &conn) {
+		if (!catalog.reload(conn))
+			std::cerr << "Catalog reload failed: " << sqlite3_errmsg(conn.db) << "\n";
+	});
 }
 
 /*
  * Requirements:
- * - Movie Id
- * - db (MUST BE OPENED BEFOREHAND!)
+ * - User ID
+ * - conn (a pooled connection)
  *
  * Returns:
  * - bool
  */
 // Small internal function to cut down on rewriting things
-static inline bool verifyMovie(std::string& id, sqlite3* db) {
-    if(!db) return false; // Check if the db exists
+static inline bool verifyPayment(int64_t user_id, Connection &conn) {
     bool result = false;
-	sqlite3_stmt *stmt = nullptr;
-
-    std::string query = "SELECT id FROM Movies WHERE id = ?";
+	Statement stmt(conn, Stmt::VerifyPayment);
+    if(!stmt) return false;
 
-    if(sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr)) {
-		sqlite3_close(db);
-        sqlite3_finalize(stmt);
-		return false;
-    }
+    sqlite3_bind_int64(stmt, 1, user_id);
 
-    sqlite3_bind_text(stmt, 1, id.c_str(), -1, SQLITE_TRANSIENT);
+    // If a row is returned then we have a valid result
+    if(stmt.step() == SQLITE_ROW) 
+        if(sqlite3_column_text(stmt, 0))
+            result = true;
 
-    if(sqlite3_step(stmt) == SQLITE_ROW) result = true;
-    sqlite3_finalize(stmt);
     return result;
 }
 
 /*
  * Requirements:
  * - Email
- * - Password
- * - db (MUST BE OPENED BEFOREHAND!)
+ * - conn (a pooled connection)
  *
  * Returns:
- * - bool
+ * - User ID, if there is such a user
  */
-// Small internal function to cut down on rewriting things
-static inline bool verifyPayment(std::string& email, std::string& password, sqlite3* db) {
-    if(!db) return false; // Check if the db exists
-    bool result = false;
-	sqlite3_stmt *stmt = nullptr;
-
-    std::string query = "SELECT payment_details FROM Users WHERE email = ? AND password = ?";
-
-    if(sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr)) {
-		sqlite3_close(db);
-        sqlite3_finalize(stmt);
-		return false;
-    }
-
-    sqlite3_bind_text(stmt, 1, email.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, password.c_str(), -1, SQLITE_TRANSIENT);
+static inline std::optional<int64_t> findUserId(std::string_view email, Connection &conn) {
+	Statement stmt(conn, Stmt::SelectUserId);
+    if(!stmt) return std::nullopt;
 
-    // If a row is returned then we have a valid result
-    if(sqlite3_step(stmt) == SQLITE_ROW) 
-        if(sqlite3_column_text(stmt, 0))
-            result = true;
+    stmt.bind(1, email);
 
-    sqlite3_finalize(stmt);
-    return result;
+    if(stmt.step() != SQLITE_ROW) return std::nullopt;
+    return (int64_t)sqlite3_column_int64(stmt, 0);
 }
 
 
@@ -434,45 +744,30 @@ static inline bool verifyPayment(std::string& email, std::string& password, sqli
  * - Fail/Success
  * - Account ID (?)
  */
-std::string createAcc(std::map<std::string, std::string> params) {
+std::string createAcc(Connection &conn, const QueryParams &params, const Caller &caller) {
     DBG_PRINT("User called createacc\n");
-	sqlite3 *db;
-
-	if (sqlite3_open(DATABASE_FILE, &db)) { //try to open the database
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Unable to open database.\"}"; // if fails, returns error
-	}
-
-	// check required fields. look above, for example
-	if (!params.count("email") || !params.count("password") || !params.count("name")) { // if ANY of these dont exist, returns error
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs \'email\',\'password\', and \'name\'\"}";
-	}
 
 	// had to learn sqlite for this.
-	std::string sql = "INSERT INTO Users (name, email, password, payment_details) VALUES (?, ?, ?, ?);";
-	sqlite3_stmt *stmt = nullptr; // generate empty pointer in case no payment details
-
-	if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		sqlite3_close(db);
+	Statement stmt(conn, Stmt::InsertUser);
+	if (!stmt) {
 		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
 	}
 
-	sqlite3_bind_text(stmt, 1, params["name"].c_str(), -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 2, params["email"].c_str(), -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 3, params["password"].c_str(), -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 4, params.count("payment_details") ? params["payment_details"].c_str() : nullptr, -1, SQLITE_TRANSIENT);
+	// Hashed by runAction before this write was queued
+	stmt.bind(1, params["name"]);
+	stmt.bind(2, params["email"]);
+	stmt.bind(3, caller.passwordHash);
+	stmt.bindOptional(4, params.get("payment_details"));
 
 	std::string result;
-	if (sqlite3_step(stmt) == SQLITE_DONE) {
-		int user_id = sqlite3_last_insert_rowid(db);
-		result = "{\"request\": \"0\", \"message\": \"Success!\", \"user_id\": \"" + std::to_string(user_id) + "\"}";
+	if (stmt.step() == SQLITE_DONE) {
+		JsonWriter json;
+		success(json).field("user_id", (int64_t)sqlite3_last_insert_rowid(conn.db)).endObject();
+		result = json.take();
 	} else {
 		result = "{\"request\": \"1\", \"message\": \"Failed to create account.\"}";
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
 	return result;
 }
 
@@ -485,43 +780,26 @@ std::string createAcc(std::map<std::string, std::string> params) {
  * Returns:
  * - Fail/Success
  */
-std::string updatePayment(std::map<std::string, std::string> params) {
+std::string updatePayment(Connection &conn, const QueryParams &params, const Caller &caller) {
     DBG_PRINT("User called updatepayment\n");
-	sqlite3 *db;
-
-	if (sqlite3_open(DATABASE_FILE, &db)) { //try to open the database
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Unable to open database.\"}"; // if fails, returns error
-	}
-
-	// check required fields. look above, for example
-	if (!params.count("email") || !params.count("password")) { // if ANY of these dont exist, returns error
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs \'email\',\'password\', and \'name\'\"}";
-	}
-
-	std::string sql = "UPDATE Users SET payment_details = ? WHERE email = ? AND password = ?";
-	sqlite3_stmt *stmt = nullptr; // generate empty pointer in case no payment details
 
-	if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		sqlite3_close(db);
+	Statement stmt(conn, Stmt::UpdatePayment);
+	if (!stmt) {
 		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
 	}
 
-	sqlite3_bind_text(stmt, 1, params.count("payment_details") ? params["payment_details"].c_str() : nullptr, -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 2, params["email"].c_str(), -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 3, params["password"].c_str(), -1, SQLITE_TRANSIENT);
+	stmt.bindOptional(1, params.get("payment_details"));
+	sqlite3_bind_int64(stmt, 2, caller.user_id);
 
 	std::string result;
-	if (sqlite3_step(stmt) == SQLITE_DONE) {
-		int user_id = sqlite3_last_insert_rowid(db);
-		result = "{\"request\": \"0\", \"message\": \"Success!\", \"user_id\": \"" + std::to_string(user_id) + "\"}";
+	if (stmt.step() == SQLITE_DONE) {
+		JsonWriter json;
+		success(json).field("user_id", caller.user_id).endObject();
+		result = json.take();
 	} else {
-		result = "{\"request\": \"1\", \"message\": \"Failed to create account.\"}";
+		result = "{\"request\": \"1\", \"message\": \"Failed to update payment details.\"}";
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
 	return result;
 }
 
@@ -534,38 +812,26 @@ std::string updatePayment(std::map<std::string, std::string> params) {
  * Returns:
  * - Fail/Success
  */
-std::string deleteAcc(std::map<std::string, std::string> params) {
+std::string deleteAcc(Connection &conn, const QueryParams &, const Caller &caller) {
     DBG_PRINT("User called deleteacc\n");
-	sqlite3 *db;
-	int rc = sqlite3_open(DATABASE_FILE, &db);
 
-	// check required fields. look above, for example
-	if (!params.count("email") || !params.count("password")) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs \'email\' and \'password\'\"}";
-	}
-
-	std::string sql = "DELETE FROM Users WHERE ? = email AND ? = password";
-	sqlite3_stmt *stmt = nullptr;
-
-	if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		sqlite3_close(db);
+	Statement stmt(conn, Stmt::DeleteUser);
+	if (!stmt) {
 		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
 	}
 
-	sqlite3_bind_text(stmt, 1, params["email"].c_str(), -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 2, params["password"].c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int64(stmt, 1, caller.user_id);
 
 	std::string result;
-	if (sqlite3_step(stmt) == SQLITE_DONE) {
-		result = "{\"request\": \"0\", \"message\": \"Successfully deleted account!\" }";
+	if (stmt.step() == SQLITE_DONE) {
+		JsonWriter json;
+		success(json, "Successfully deleted account!").endObject();
+		result = json.take();
+		writePipeline.afterCommit([user_id = caller.user_id](Connection &) { sessions.revokeUser(user_id); });
 	} else {
 		result = "{\"request\": \"1\", \"message\": \"Failed to delete account.\"}";
 	}
 
-	sqlite3_finalize(stmt);
-
-	sqlite3_close(db);
 	return result;
 }
 
@@ -580,51 +846,71 @@ std::string deleteAcc(std::map<std::string, std::string> params) {
  * - Fail/Success
  * - Ticket ID(s)
  */
-std::string buyTicket(std::map<std::string, std::string> params) {
+std::string buyTicket(Connection &conn, const QueryParams &params, const Caller &caller) {
     DBG_PRINT("User called buyticket\n");
-	sqlite3 *db;
-	int rc = sqlite3_open(DATABASE_FILE, &db);
-	// check required fields. look above, for example
-	if (!params.count("email")|| !params.count("password") || !params.count("ticket_amount") || !params.count("movie_id")) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs \'email\', \'password\', \'ticket_amount\', \'movie_id\'\"}";
-	}
 
-    // Check if the movie is real
-    if(!verifyMovie(params["movie_id"], db)) 
+    auto movie_id = parseId(params["movie_id"]);
+    if(!movie_id)
 		return "{\"request\": \"1\", \"message\": \"Invalid movie id\"}";
+    auto quantity = parseId(params["ticket_amount"]);
+    if(!quantity || *quantity < 1)
+		return "{\"request\": \"1\", \"message\": \"Invalid ticket amount.\"}";
+
+    // Claim the seats in memory first, a sold-out showing never gets as far as SQLite
+    switch(seats.reserve(*movie_id, *quantity)) {
+        case SeatLedger::Result::NoShowing:
+			return "{\"request\": \"1\", \"message\": \"Invalid movie id\"}";
+        case SeatLedger::Result::SoldOut:
+			return "{\"request\": \"1\", \"message\": \"Not enough seats left.\"}";
+        case SeatLedger::Result::Reserved:
+            break;
+    }
 
-    if(!verifyPayment(params["email"], params["password"], db))
-        return "{\"request\": \"1\", \"message\": \"User does not have a registered payment method.\"}";
-
-    // Please nested query... Please just work
-	std::string sql = "INSERT INTO Tickets(user_id, movie_id, quantity, purchase_time) VALUES ( (SELECT id FROM Users WHERE ? = email AND ? = password),?,?,?) ";
-	sqlite3_stmt *stmt = nullptr;
-
-	if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
-	}
-
-	sqlite3_bind_text(stmt, 1, params["email"].c_str(), -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 2, params["password"].c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 3, params["movie_id"].c_str(), -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 4, params["ticket_amount"].c_str(), -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 5, std::to_string(time(NULL)).c_str(), -1, SQLITE_TRANSIENT);
+    {
+        TraceSpan span(Stage::Payment);
+        if(!verifyPayment(caller.user_id, conn)) {
+            seats.release(*movie_id, *quantity);
+            return "{\"request\": \"1\", \"message\": \"User does not have a registered payment method.\"}";
+        }
+    }
 
-	std::string result;
-	if ((rc = sqlite3_step(stmt)) == SQLITE_DONE) {
-		int ticket_id = sqlite3_last_insert_rowid(db);
-		result = "{\"request\": \"0\", \"message\": \"Success!\", \"ticket_id\": \"" + std::to_string(ticket_id) + "\"}";
-	} else {
-		result = "{\"request\": \"1\", \"message\": \"Failed to purchase ticket.\"}";
-	}
+    // Seats and ticket go in together or not at all
+    int64_t ticket_id = 0;
+    bool bought = false, disagreed = false;
+    {
+        TraceSpan span(Stage::Sql);
+        Transaction txn(conn);
+        Statement take(conn, Stmt::TakeSeats);
+        Statement insert(conn, Stmt::InsertTicket);
+        if (txn && take && insert) {
+            sqlite3_bind_int64(take, 1, *quantity);
+            sqlite3_bind_int64(take, 2, *movie_id);
+
+            sqlite3_bind_int64(insert, 1, caller.user_id);
+            sqlite3_bind_int64(insert, 2, *movie_id);
+            sqlite3_bind_int64(insert, 3, *quantity);
+            insert.bindCopy(4, std::to_string(time(NULL)));
+
+            if (take.step() == SQLITE_DONE) {
+                // No row changed means the table disagrees with the ledger
+                disagreed = sqlite3_changes(conn.db) != 1;
+                if (!disagreed && insert.step() == SQLITE_DONE) {
+                    ticket_id = sqlite3_last_insert_rowid(conn.db);
+                    bought = txn.commit();
+                }
+            }
+        }
+    }
 
-	sqlite3_finalize(stmt);
-    //sqlite3_finalize(payment_stmt);
-	sqlite3_close(db);
+    if (!bought) {
+        // The table wins, the ledger is set from it rather than just handed the seats back
+        if (!disagreed || !seats.resync(conn, *movie_id)) seats.release(*movie_id, *quantity);
+		return "{\"request\": \"1\", \"message\": \"Failed to purchase ticket.\"}";
+    }
 
-	return result;
+	JsonWriter json;
+	success(json).field("ticket_id", ticket_id).endObject();
+	return json.take();
 } 
 
 /*
@@ -637,47 +923,36 @@ std::string buyTicket(std::map<std::string, std::string> params) {
  * - Fail/Success
  * - Ticket information
  */
-std::string getTicket(std::map<std::string, std::string> params) {
+std::string getTicket(Connection &conn, const QueryParams &params, const Caller &caller) {
     DBG_PRINT("User called getticket\n");
-    sqlite3 *db;
-    int rc = sqlite3_open(DATABASE_FILE, &db);
 
-    // check required fields. look above, for example
-    if (!params.count("email") || !params.count("password")) {
-        sqlite3_close(db);
-        return "{\"request\": \"1\", \"message\": \"Missing fields: Needs \'email\' and \'password\'\"}";
-    }
+    // Paged by ticket id, ids start at 1
+    Page page;
+    std::optional<int64_t> after = 0;
+    if (!page.parse(params, 1) || (!page.after.empty() && !(after = parseId(page.after[0]))))
+        return "{\"request\": \"1\", \"message\": \"Invalid page.\"}";
 
     // If wanting a specific movie send w/ a movie_id, otherwise just send all tickets attached to a user
-    std::string sql = (params.count("movie_id")) ? 
-        "SELECT * FROM Tickets WHERE user_id = (SELECT id FROM Users WHERE password = ? and email = ?) AND movie_id = ?" 
-        :
-        "SELECT * FROM Tickets WHERE user_id = (SELECT id FROM Users WHERE password = ? and email = ?)" ;
-
-    sqlite3_stmt *stmt = nullptr;
-
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-        sqlite3_close(db);
+    Statement stmt(conn, params.count("movie_id") ? Stmt::SelectTicketsForMovie : Stmt::SelectTickets);
+    if (!stmt) {
         return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
     }
 
-    sqlite3_bind_text(stmt, 1, params["password"].c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, params["email"].c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 1, caller.user_id);
+    sqlite3_bind_int64(stmt, 2, *after);
+    sqlite3_bind_int64(stmt, 3, (int64_t)page.limit + 1);
     if(params.count("movie_id")) 
-        sqlite3_bind_text(stmt, 3, params["movie_id"].c_str(), -1, SQLITE_TRANSIENT);
+        stmt.bind(4, params["movie_id"]);
 
     std::string result;
-    rc = sqlite3_step(stmt);
-    if (rc == SQLITE_ROW) {
-        std::string entries = parseSelect(stmt);
-        result = "{\"request\": \"0\", \"message\": \"Success!\", \"tickets\": " + entries + "}";
+    if (stmt.step() == SQLITE_ROW) {
+        JsonWriter json(4096);
+        pageRows(success(json), "tickets", stmt, page.limit, idCursor).endObject();
+        result = json.take();
     } else {
         result = "{\"request\": \"1\", \"message\": \"Failed to find tickets.\"}";
     }
 
-    sqlite3_finalize(stmt);
-
-    sqlite3_close(db);
     return result;
     
 }
@@ -691,41 +966,30 @@ std::string getTicket(std::map<std::string, std::string> params) {
  * Returns:
  * - Fail/Success
  */
-std::string adminAdd(std::map<std::string, std::string> params) {
+std::string adminAdd(Connection &conn, const QueryParams &params, const Caller &) {
     DBG_PRINT("User called adminadd\n");
-	sqlite3 *db;
-	int rc = sqlite3_open(DATABASE_FILE, &db);
     std::string result;
 
-    if(!params.count("email") || !params.count("target") || !params.count("password")) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs \'email\' and \'password\' \'target\'\"}";
-    }
-
-    // Check if the user is admin
-    if(!isAdmin(params["email"], params["password"], db))
-        return "{\"request\": \"1\", \"message\": \"Permission denied.\"}";
+    auto target = findUserId(params["target"], conn);
+    if(!target)
+		return "{\"request\": \"1\", \"message\": \"No such user.\"}";
 
     // Insert target
-    std::string sql = "INSERT INTO Admins (user_id) VALUES ((SELECT id FROM Users WHERE email = ?))";
-    sqlite3_stmt *stmt = nullptr;
-    
-    if(sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr)) {
-        sqlite3_close(db);
+    Statement stmt(conn, Stmt::InsertAdmin);
+    if(!stmt) {
 		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
     }
 
-    sqlite3_bind_text(stmt, 1, params["target"].c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 1, *target);
 
-    if(sqlite3_step(stmt) == SQLITE_DONE) {
-        int admin_id = sqlite3_last_insert_rowid(db);
-		result = "{\"request\": \"0\", \"message\": \"Success!\", \"admin_id\": \"" + std::to_string(admin_id) + "\"}";
+    if(stmt.step() == SQLITE_DONE) {
+		JsonWriter json;
+		success(json).field("admin_id", *target).endObject();
+		result = json.take();
+		writePipeline.afterCommit([user_id = *target](Connection &) { admins.insert(user_id); });
     } else
-		result = "{\"request\": \"1\", \"message\": \"Failed to delete account.\"}";
+		result = "{\"request\": \"1\", \"message\": \"Failed to add admin.\"}";
 
-    sqlite3_finalize(stmt);
-
-	sqlite3_close(db);
 	return result;
 }
 
@@ -739,38 +1003,29 @@ std::string adminAdd(std::map<std::string, std::string> params) {
  * Returns:
  * - Fail/Success
  */
-std::string adminDel(std::map<std::string, std::string> params) {
+std::string adminDel(Connection &conn, const QueryParams &params, const Caller &) {
     DBG_PRINT("User called admindel\n");
-	sqlite3 *db;
-	int rc = sqlite3_open(DATABASE_FILE, &db);
     std::string result;
 
-    if(!params.count("email") || !params.count("target") || !params.count("password")) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs \'email\' and \'password\' \'target\'\"}";
-    }
-
-    if(!isAdmin(params["email"], params["password"], db))
-		return "{\"request\": \"1\", \"message\": \"Permission denied.\"}";
+    auto target = findUserId(params["target"], conn);
+    if(!target)
+		return "{\"request\": \"1\", \"message\": \"No such user.\"}";
 
     // Remove target
-    std::string sql = "DELETE FROM Admins WHERE user_id = (SELECT id FROM Users WHERE email = ?)";
-    sqlite3_stmt *stmt = nullptr;
-    
-    if(sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr)) {
-        sqlite3_close(db);
+    Statement stmt(conn, Stmt::DeleteAdmin);
+    if(!stmt) {
 		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
     }
 
-    sqlite3_bind_text(stmt, 1, params["target"].c_str(), -1, SQLITE_TRANSIENT);
-
-    if(sqlite3_step(stmt) == SQLITE_DONE) 
-		result = "{\"request\": \"1\", \"message\": \"Successfully deleted account.\"}";
-    else
-		result = "{\"request\": \"1\", \"message\": \"Failed to delete account.\"}";
+    sqlite3_bind_int64(stmt, 1, *target);
 
-    sqlite3_finalize(stmt);
-	sqlite3_close(db);
+    if(stmt.step() == SQLITE_DONE) {
+		JsonWriter json;
+		success(json, "Successfully removed admin.").endObject();
+		result = json.take();
+		writePipeline.afterCommit([user_id = *target](Connection &) { admins.erase(user_id); });
+    } else
+		result = "{\"request\": \"1\", \"message\": \"Failed to remove admin.\"}";
 
 	return result;
 }
@@ -783,48 +1038,57 @@ std::string adminDel(std::map<std::string, std::string> params) {
  * - Showtime
  * - Price
  * - Rating
+ * - Theater ID
+ * - Capacity (optional, seats in the showing)
  *
  * Returns:
  * - Fail/Success
  * - Movie ID
  */
-std::string addMovie(std::map<std::string, std::string> params) {
+std::string addMovie(Connection &conn, const QueryParams &params, const Caller &) {
     DBG_PRINT("User called addmovie\n");
-	sqlite3 *db;
-	int rc = sqlite3_open(DATABASE_FILE, &db);
 
-	if (!params.count("email") || !params.count("password") || !params.count("movie_name") || !params.count("showtime") || !params.count("price") || !params.count("rating")) { // if ANY of these dont exist, returns error
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs \'email\', \'password\', \'movie_name\', \'showtime\', \'price\', \'rating\'\"}";
+	int64_t capacity = DEFAULT_CAPACITY;
+	if (params.count("capacity")) {
+		auto parsed = parseId(params["capacity"]);
+		if (!parsed || *parsed < 1)
+			return "{\"request\": \"1\", \"message\": \"Invalid capacity.\"}";
+		capacity = *parsed;
 	}
 
-    // Check if user is admin
-    if(!isAdmin(params["email"], params["password"], db))
-		return "{\"request\": \"1\", \"message\": \"Permission denied.\"}";
-
-	std::string sql = "INSERT INTO Movies(name,showtime,price_per_ticket,rating) VALUES (?,?,?,?)";
-	sqlite3_stmt *stmt = nullptr;
+	// The movie and its seats are added together
+	int64_t movie_id = 0;
+	bool added = false;
+	{
+		Transaction txn(conn);
+		Statement stmt(conn, Stmt::InsertMovie);
+		Statement seatStmt(conn, Stmt::InsertSeats);
+		if (!txn || !stmt || !seatStmt) {
+			return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
+		}
 
-	if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
+		stmt.bind(1, params["movie_name"]);
+		stmt.bind(2, params["showtime"]);
+		stmt.bind(3, params["price"]);
+		stmt.bind(4, params["rating"]);
+		stmt.bind(5, params["theater_id"]);
+
+		if (stmt.step() == SQLITE_DONE) {
+			movie_id = sqlite3_last_insert_rowid(conn.db);
+			sqlite3_bind_int64(seatStmt, 1, movie_id);
+			sqlite3_bind_int64(seatStmt, 2, capacity);
+			added = seatStmt.step() == SQLITE_DONE && txn.commit();
+		}
 	}
 
-	sqlite3_bind_text(stmt, 1, params["movie_name"].c_str(), -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 2, params["showtime"].c_str(), -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 3, params["price"].c_str(), -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 4, params["rating"].c_str(), -1, SQLITE_TRANSIENT);
+	if (!added) return "{\"request\": \"1\", \"message\": \"Failed to add movie.\"}";
 
-	std::string result;
-	if (sqlite3_step(stmt) == SQLITE_DONE) {
-		int movie_id = sqlite3_last_insert_rowid(db); // This prolly needs to be changed
-		result = "{\"request\": \"0\", \"message\": \"Success!\", \"movie_id\": \"" + std::to_string(movie_id) + "\"}";
-	} else result = "{\"request\": \"1\", \"message\": \"Failed to add movie.\"}";
-
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	writePipeline.afterCommit([movie_id, capacity](Connection &) { seats.add(movie_id, capacity); });
+	refreshCatalog();
 
-	return result;
+	JsonWriter json;
+	success(json).field("movie_id", movie_id).endObject();
+	return json.take();
 }
 
 /*
@@ -836,39 +1100,34 @@ std::string addMovie(std::map<std::string, std::string> params) {
  * Returns:
  * - Fail/Success
  */
-std::string delMovie(std::map<std::string, std::string> params) {
+std::string delMovie(Connection &conn, const QueryParams &params, const Caller &) {
     DBG_PRINT("User called delmovie\n");
-	sqlite3 *db;
-	int rc = sqlite3_open(DATABASE_FILE, &db);
 
-	if (!params.count("email") || !params.count("password") || !params.count("movie_id")){ // if ANY of these dont exist, returns error
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs \'email\', \'password\', and \'movie_id\'\"}";
-	}
+	bool deleted = false;
+	{
+		Transaction txn(conn);
+		Statement stmt(conn, Stmt::DeleteMovie);
+		Statement seatStmt(conn, Stmt::DeleteSeats);
+		if (!txn || !stmt || !seatStmt) {
+			return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
+		}
 
-    // Check if user is admin
-    if(!isAdmin(params["email"], params["password"], db))
-		return "{\"request\": \"1\", \"message\": \"Permission denied.\"}";
+		stmt.bind(1, params["movie_id"]);
+		seatStmt.bind(1, params["movie_id"]);
 
-	std::string sql = "DELETE FROM Movies WHERE id = ?";
-	sqlite3_stmt *stmt = nullptr;
-
-	if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
+		deleted = stmt.step() == SQLITE_DONE && seatStmt.step() == SQLITE_DONE && txn.commit();
 	}
 
-	sqlite3_bind_text(stmt, 1, params["movie_id"].c_str(), -1, SQLITE_TRANSIENT);
+	if (!deleted) return "{\"request\": \"1\", \"message\": \"Failed to delete movie.\"}";
 
-	std::string result;
-	if (sqlite3_step(stmt) == SQLITE_DONE) {
-		result = "{\"request\": \"0\", \"message\": \"Success!\"}";
-	} else result = "{\"request\": \"1\", \"message\": \"Failed to delete movie.\"}";
-
-	sqlite3_finalize(stmt);
+	if (auto id = parseId(params["movie_id"])) {
+		writePipeline.afterCommit([movie_id = *id](Connection &) { seats.remove(movie_id); });
+	}
+	refreshCatalog();
 
-	sqlite3_close(db);
-	return result;
+	JsonWriter json;
+	success(json).endObject();
+	return json.take();
 }
 
 /*
@@ -882,43 +1141,23 @@ std::string delMovie(std::map<std::string, std::string> params) {
  * - Payment information (?)
  * - Admin status
  */
-std::string accDetails(std::map<std::string, std::string> params) {
+std::string accDetails(Connection &conn, const QueryParams &, const Caller &caller) {
     DBG_PRINT("User called accdetails\n");
-	sqlite3 *db;
-	int rc = sqlite3_open(DATABASE_FILE, &db);
-    std::string sql, result;
-
-	// check required fields. look above, for example
-    if (!params.count("email") || !params.count("password")) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs \'email\' and \'password\'\"}";
-    }
-
-    if(!isAdmin(params["email"], params["password"], db))
-        sql = "SELECT * FROM Users WHERE email = ? AND password = ?";
-    else
-        sql = "SELECT U.*, CASE WHEN U.id = A.user_id THEN 1 WHEN U.id <> A.user_id THEN 0 END AS is_admin FROM Users U INNER JOIN Admins A ON A.user_id = U.id WHERE U.email = ? AND U.password = ?";
-
-	sqlite3_stmt *stmt = nullptr;
-
+    std::string result;
 
-	if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		sqlite3_close(db);
+	Statement stmt(conn, caller.admin ? Stmt::SelectAdminUser : Stmt::SelectUser);
+	if (!stmt) {
 		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
 	}
 
-    sqlite3_bind_text(stmt, 1, params["email"].c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, params["password"].c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 1, caller.user_id);
 
-    rc = sqlite3_step(stmt);
-	if (rc == SQLITE_ROW) {
-        std::string entries = parseSelect(stmt);
-		result = "{\"request\": \"0\", \"message\": \"Success!\", \"user\": \"" + entries + "\"}";
+	if (stmt.step() == SQLITE_ROW) {
+		JsonWriter json(512);
+		success(json).key("user").rows(stmt).endObject();
+		result = json.take();
 	} else result = "{\"request\": \"1\", \"message\": \"Failed to get account info.\"}";
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
-
 	return result;
 }
 
@@ -930,91 +1169,104 @@ std::string accDetails(std::map<std::string, std::string> params) {
  * - Rating
  * - Price
  */
-std::string listMovies(std::map<std::string, std::string> params) {
+std::string listMovies(Connection &, const QueryParams &params, const Caller &) {
     DBG_PRINT("User called listmovies\n");
-	sqlite3 *db;
-	std::string sql,result;
-	int rc = sqlite3_open(DATABASE_FILE, &db);
-    char list_mode = 0x0; // Bitflag for options
-
-    sql = "SELECT * FROM Movies";
-
-    if (params.count("movie_name")) {
-        sql += " WHERE name LIKE CONCAT(?, '%')";
-        list_mode |= 0x1;
+	const CatalogSnapshot &snap = catalog.snapshot();
+
+    auto name = params.get("movie_name");
+    auto showtime = params.get("showtime");
+    std::optional<int64_t> theater;
+    if (params.count("theater_id")) {
+        theater = parseId(params["theater_id"]);
+        if (!theater) return "{\"request\": \"1\", \"message\": \"Failed to get movie info.\"}";
     }
-    if (params.count("showtime")) { 
-        sql += (list_mode) 
-            ? " AND showtime = ?"
-            : " WHERE showtime = ?";
-        list_mode |= 0x2;
-    } 
-
-	sqlite3_stmt *stmt = nullptr;
-
-	if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
-	}
 
-    int field = 1;
-
-    if(list_mode & 0x1) 
-        sqlite3_bind_text(stmt, field++, params["movie_name"].c_str(), -1, SQLITE_TRANSIENT);
-    if(list_mode & 0x2) 
-        sqlite3_bind_text(stmt, field++, params["showtime"].c_str(), -1, SQLITE_TRANSIENT);
-
-    rc = sqlite3_step(stmt);
-	if (rc == SQLITE_ROW) {
-        std::string entries = parseSelect(stmt);
-		result = "{\"request\": \"0\", \"message\": \"Success!\", \"movies\": " + entries + "}";
-	} else result = "{\"request\": \"1\", \"message\": \"Failed to get movie info.\"}";
+    // Cursor is the folded name (only when walking by name) and the id of the last movie sent
+    Page page;
+    std::optional<int64_t> afterId;
+    if (!page.parse(params, 2) || (!page.after.empty() && !(afterId = parseId(page.after[1]))))
+        return "{\"request\": \"1\", \"message\": \"Invalid page.\"}";
+
+    // Walk whichever index narrows it down most, check the rest per movie
+    CatalogSnapshot::Range range = snap.all();
+    bool byName = false;
+    if (showtime) range = snap.showtimeRange(*showtime);
+    else if (theater) range = snap.theaterRange(*theater);
+    else if (name) range = snap.nameRange(*name), byName = true;
+
+    // Every range is sorted by its key then id, and within the showtime and
+    // theater ranges the key never changes, so this is a binary search
+    if (afterId) {
+        const std::string &afterName = page.after[0];
+        range.first = std::partition_point(range.first, range.second, [&](uint32_t i) {
+            const CatalogMovie &movie = snap.movies[i];
+            if (byName) return std::tie(movie.folded, movie.id) <= std::tie(afterName, *afterId);
+            return movie.id <= *afterId;
+        });
+    }
 
-	sqlite3_finalize(stmt);
+    JsonWriter json(16384);
+    success(json).key("movies").beginArray();
+    size_t count = 0;
+    const CatalogMovie *last = nullptr;
+    bool more = false;
+    for (const uint32_t *i = range.first; i != range.second; i++) {
+        const CatalogMovie &movie = snap.movies[*i];
+        if (showtime && movie.showtime != *showtime) continue;
+        if (theater && movie.theater_id != *theater) continue;
+        if (name && !movie.nameStartsWith(*name)) continue;
+        if (count == page.limit) {
+            more = true;
+            break;
+        }
+        json.raw(movie.json);
+        last = &movie;
+        count++;
+    }
+    json.endArray();
+    if (more) json.field("next", makeCursor({byName ? std::string_view(last->folded) : std::string_view(), std::to_string(last->id)}));
+    json.endObject();
 
-	sqlite3_close(db);
-	return result;
+    if (!count) return "{\"request\": \"1\", \"message\": \"Failed to get movie info.\"}";
+	return json.take();
 }
 
 /*
+ * Requirements:
+ * - Email
+ * - Hashed Password
+ *
  * Returns:
  * - User ID
+ * - Session token, for the other actions to use instead of email/password
  */
-std::string verifyAcc(std::map<std::string, std::string> params) {
+std::string verifyAcc(Connection &, const QueryParams &, const Caller &caller) {
     DBG_PRINT("User called verifyacc\n");
-	sqlite3 *db;
-	if (sqlite3_open(DATABASE_FILE, &db)) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Unable to open database.\"}";
-	}
-
-	if (params.count("email") == 0 || params.count("password") == 0) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs 'email' and 'password'\"}";
-	}
 
-	std::string sql = "SELECT id FROM Users WHERE email = ? AND password = ?;";
-	sqlite3_stmt *stmt = nullptr;
+	std::string token = sessions.issue(caller.user_id);
+	if (token.empty())
+		return "{\"request\": \"1\", \"message\": \"Failed to start session.\"}";
 
-	if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
-	}
+	JsonWriter json;
+	success(json, "Login successful.").field("user_id", caller.user_id).field("token", token).endObject();
+	return json.take();
+}
 
-	sqlite3_bind_text(stmt, 1, params["email"].c_str(), -1, SQLITE_TRANSIENT);
-	sqlite3_bind_text(stmt, 2, params["password"].c_str(), -1, SQLITE_TRANSIENT);
+/*
+ * Requirements:
+ * - Session token
+ *
+ * Returns:
+ * - Fail/Success
+ */
+std::string logout(Connection &, const QueryParams &params, const Caller &) {
+    DBG_PRINT("User called logout\n");
 
-	std::string result;
-	if (sqlite3_step(stmt) == SQLITE_ROW) {
-		int user_id = sqlite3_column_int(stmt, 0);
-		result = "{\"request\": \"0\", \"message\": \"Login successful.\", \"user_id\": \"" + std::to_string(user_id) + "\"}";
-	} else {
-		result = "{\"request\": \"1\", \"message\": \"Invalid email or password.\"}";
-	}
+	sessions.revoke(params["token"]);
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
-	return result;
+	JsonWriter json;
+	success(json).endObject();
+	return json.take();
 }
 
 /*
@@ -1025,47 +1277,24 @@ std::string verifyAcc(std::map<std::string, std::string> params) {
  * - price
  * - rating
  */
-std::string getMovie(std::map<std::string, std::string> params) {
+std::string getMovie(Connection &, const QueryParams &params, const Caller &) {
     DBG_PRINT("User called getmovie\n");
-	sqlite3 *db;
-	int rc = sqlite3_open(DATABASE_FILE, &db);
-
-	if (rc) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Unable to open database.\"}";
-	}
-
-	if (!params.count("movie_id")) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing field: Needs 'movie_id'\"}";
-	}
-
-	std::string sql = "SELECT id, name, showtime, price_per_ticket, rating FROM Movies WHERE id = ?;";
-	sqlite3_stmt *stmt = nullptr;
-
-	if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
-	}
-
-	sqlite3_bind_text(stmt, 1, params["movie_id"].c_str(), -1, SQLITE_TRANSIENT);
-
-	std::string result;
-	if (sqlite3_step(stmt) == SQLITE_ROW) {
-		int id = sqlite3_column_int(stmt, 0);
-		const char *name = (const char*)sqlite3_column_text(stmt, 1);
-		const char *showtime = (const char*)sqlite3_column_text(stmt, 2);
-		double price_per_ticket = sqlite3_column_double(stmt, 3);
-		const char *rating = (const char*)sqlite3_column_text(stmt, 4);
-
-		result = "{\"request\": \"0\", \"message\": \"Success!\", \"movie\": {\"id\": \"" + std::to_string(id) + "\", \"name\": \"" + name + "\", \"showtime\": \"" + showtime + "\", \"price_per_ticket\": " + std::to_string(price_per_ticket) + ", \"rating\": \"" + rating + "\"}}";
-	} else {
-		result = "{\"request\": \"1\", \"message\": \"Movie not found.\"}";
-	}
-
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
-	return result;
+	const CatalogSnapshot &snap = catalog.snapshot();
+
+	auto id = parseId(params["movie_id"]);
+	const CatalogMovie *movie = id ? snap.movie(*id) : nullptr;
+	if (!movie) return "{\"request\": \"1\", \"message\": \"Movie not found.\"}";
+
+	JsonWriter json;
+	success(json).key("movie").beginObject()
+		.field("id", movie->id)
+		.field("name", movie->name)
+		.field("showtime", movie->showtime)
+		.field("price_per_ticket", movie->price)
+		.field("rating", movie->rating)
+		.field("seats_left", seats.remaining(movie->id).value_or(0))
+		.endObject().endObject();
+	return json.take();
 }
 
 /*
@@ -1075,28 +1304,19 @@ std::string getMovie(std::map<std::string, std::string> params) {
  * Input:
  * - Email and Password
  */
-std::string adminVerify(std::map<std::string, std::string> params) {
+std::string adminVerify(Connection &, const QueryParams &, const Caller &caller) {
     DBG_PRINT("User called adminverify\n");
-	sqlite3 *db;
 	std::string result;
-	int rc = sqlite3_open(DATABASE_FILE, &db);
-	if (rc) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Unable to open database.\"}";
-	}
-
-	if (!params.count("email") || !params.count("password")) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs 'email' and 'password'\"}";
-	}
 
     // This isn't quite as complete but avoids rewriting the same thing
-    if(isAdmin(params["email"], params["password"], db))
-		result = "{\"request\": \"0\", \"message\": \"User is admin.\"}";
+    if(caller.admin)
+	{
+		JsonWriter json;
+		success(json, "User is admin.").endObject();
+		result = json.take();
+	}
     else result = "{\"request\": \"1\", \"message\": \"User is not an admin.\"}";
 
-	//sqlite3_finalize(stmt);
-	sqlite3_close(db);
 	return result;
 }
 
@@ -1110,37 +1330,26 @@ std::string adminVerify(std::map<std::string, std::string> params) {
  * Returns:
  * - Fail/Success
  */
-std::string reviewAdd(std::map<std::string, std::string> params) {
+std::string reviewAdd(Connection &conn, const QueryParams &params, const Caller &caller) {
     DBG_PRINT("User called reviewadd\n");
-    sqlite3* db = NULL;
-    std::string sql,result;
-    sqlite3_stmt* stmt = NULL;
-
-    sqlite3_open(DATABASE_FILE, &db);
-    if(!params.count("email") || !params.count("password") || !params.count("movie_id") || !params.count("review")) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs \'email\', \'password\', and \'review\'\"}";
-    }
-    
-    sql = "INSERT INTO Reviews(user_id, movie_id, review) VALUES ((SELECT id FROM Users WHERE email = ? AND password = ?), ?, ?)";
+    std::string result;
 
-	if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		sqlite3_close(db);
+    
+	Statement stmt(conn, Stmt::InsertReview);
+	if (!stmt) {
 		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
 	}
 
-    sqlite3_bind_text(stmt, 1, params["email"].c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, params["password"].c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 3, params["movie_id"].c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 4, params["review"].c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 1, caller.user_id);
+    stmt.bind(2, params["movie_id"]);
+    stmt.bind(3, params["review"]);
 
-	if (sqlite3_step(stmt) == SQLITE_DONE) {
-		result = "{\"request\": \"0\", \"message\": \"Success!\"}";
+	if (stmt.step() == SQLITE_DONE) {
+		JsonWriter json;
+		success(json).endObject();
+		result = json.take();
 	} else result = "{\"request\": \"1\", \"message\": \"Failed to submit review.\"}";
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
-
     return result;
 }
 
@@ -1153,40 +1362,125 @@ std::string reviewAdd(std::map<std::string, std::string> params) {
  * - Reviewer ID
  * - Review
  */
-std::string reviewList(std::map<std::string, std::string> params) {
+std::string reviewList(Connection &conn, const QueryParams &params, const Caller &) {
     DBG_PRINT("User called reviewlist\n");
-    sqlite3* db = NULL;
-    std::string sql,result;
-    sqlite3_stmt* stmt = NULL;
-
-    int rc = sqlite3_open(DATABASE_FILE, &db);
-
-    if(!params.count("movie_id")) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs \'movie_id\'\"}";
-    }
+    std::string result;
 
-    sql = "SELECT user_id, review FROM Reviews WHERE movie_id = ?";
+	// Paged by reviewer id, ids start at 1
+	Page page;
+	std::optional<int64_t> after = 0;
+	if (!page.parse(params, 1) || (!page.after.empty() && !(after = parseId(page.after[0]))))
+		return "{\"request\": \"1\", \"message\": \"Invalid page.\"}";
 
-	if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		sqlite3_close(db);
+	Statement stmt(conn, Stmt::SelectReviews);
+	if (!stmt) {
 		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
 	}
 
-    sqlite3_bind_text(stmt, 1, params["movie_id"].c_str(), -1, SQLITE_TRANSIENT);
+    stmt.bind(1, params["movie_id"]);
+    sqlite3_bind_int64(stmt, 2, *after);
+    sqlite3_bind_int64(stmt, 3, (int64_t)page.limit + 1);
 
-    rc = sqlite3_step(stmt);
-	if (rc == SQLITE_ROW) {
-        std::string entries = parseSelect(stmt);
-		result = "{\"request\": \"0\", \"message\": \"Success!\", \"reviews\": \"" + entries + "\"}";
+	if (stmt.step() == SQLITE_ROW) {
+		JsonWriter json(4096);
+		pageRows(success(json), "reviews", stmt, page.limit, idCursor).endObject();
+		result = json.take();
 	} else result = "{\"request\": \"1\", \"message\": \"Failed to select reviews.\"}";
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
-
     return result;
 }
 
+/*
+ * Turns what the user typed into an FTS5 query: every word must appear,
+ * each as the start of a word so partial titles match. Anything that isn't
+ * a letter or digit only separates words, so FTS5 syntax typed by the user
+ * is never interpreted. Empty if there are no words.
+ */
+static std::string prefixQuery(std::string_view text) {
+	std::string query;
+	size_t i = 0;
+	while (i < text.size()) {
+		// Bytes over 0x7f are UTF-8, let the tokenizer decide about those
+		auto inWord = [&](size_t at) { return isalnum((unsigned char)text[at]) || (unsigned char)text[at] > 0x7f; };
+		if (!inWord(i)) {
+			i++;
+			continue;
+		}
+		size_t start = i;
+		while (i < text.size() && inWord(i)) i++;
+		if (!query.empty()) query += ' ';
+		query += '"';
+		query += text.substr(start, i - start);
+		query += "\"*";
+	}
+	return query;
+}
+
+/*
+ * Requirements:
+ * - Search text (q)
+ * - What to search (in: movies, reviews or both, optional)
+ *
+ * Returns:
+ * - Fail/Success
+ * - Matching movies, best match first
+ * - Matching reviews, best match first
+ */
+std::string search(Connection &conn, const QueryParams &params, const Caller &) {
+    DBG_PRINT("User called search\n");
+
+	// Ranked, so there is no cursor to page on, only a limit
+	Page page;
+	if (!page.parse(params, 0))
+		return "{\"request\": \"1\", \"message\": \"Invalid page.\"}";
+
+	std::string_view in = params.get("in").value_or("both");
+	bool movies = in == "movies" || in == "both";
+	bool reviews = in == "reviews" || in == "both";
+	if (!movies && !reviews)
+		return "{\"request\": \"1\", \"message\": \"Can only search movies, reviews or both.\"}";
+
+	std::string query = prefixQuery(params["q"]);
+	if (query.empty())
+		return "{\"request\": \"1\", \"message\": \"Nothing to search for.\"}";
+
+	JsonWriter json(4096);
+	success(json);
+
+	if (movies) {
+		Statement stmt(conn, Stmt::SearchMovies);
+		if (!stmt) return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
+		stmt.bind(1, query);
+		sqlite3_bind_int64(stmt, 2, (int64_t)page.limit);
+
+		// The index only has ids, the rows come from the catalog already rendered
+		const CatalogSnapshot &snap = catalog.snapshot();
+		json.key("movies").beginArray();
+		int rc;
+		while ((rc = stmt.step()) == SQLITE_ROW) {
+			const CatalogMovie *movie = snap.movie(sqlite3_column_int64(stmt, 0));
+			if (movie) json.raw(movie->json);
+		}
+		json.endArray();
+		if (rc != SQLITE_DONE) return "{\"request\": \"1\", \"message\": \"Failed to search.\"}";
+	}
+
+	if (reviews) {
+		Statement stmt(conn, Stmt::SearchReviews);
+		if (!stmt) return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
+		stmt.bind(1, query);
+		sqlite3_bind_int64(stmt, 2, (int64_t)page.limit);
+
+		int rc = stmt.step();
+		if (rc == SQLITE_ROW) json.key("reviews").rows(stmt);
+		else if (rc == SQLITE_DONE) json.key("reviews").beginArray().endArray();
+		else return "{\"request\": \"1\", \"message\": \"Failed to search.\"}";
+	}
+
+	json.endObject();
+	return json.take();
+}
+
 /*
  * Requirements:
  * - Email (w. admin status)
@@ -1197,39 +1491,24 @@ std::string reviewList(std::map<std::string, std::string> params) {
  * - Fail/Success
  * - Theater ID
  */
-std::string addTheater(std::map<std::string, std::string> params) {
+std::string addTheater(Connection &conn, const QueryParams &params, const Caller &) {
     DBG_PRINT("User called addtheater\n");
-	sqlite3 *db;
-	int rc = sqlite3_open(DATABASE_FILE, &db);
-
-	if (!params.count("email") || !params.count("password") || !params.count("theater_name")) { // if ANY of these dont exist, returns error
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs \'email\', \'password\', and \'theater_name\'\"}";
-	}
-
-    // Check if user is admin
-    if(!isAdmin(params["email"], params["password"], db))
-		return "{\"request\": \"1\", \"message\": \"Permission denied.\"}";
 
-	std::string sql = "INSERT INTO Theaters(name) VALUES (?)";
-	sqlite3_stmt *stmt = nullptr;
-
-	if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		sqlite3_close(db);
+	Statement stmt(conn, Stmt::InsertTheater);
+	if (!stmt) {
 		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
 	}
 
-	sqlite3_bind_text(stmt, 1, params["theater_name"].c_str(), -1, SQLITE_TRANSIENT);
+	stmt.bind(1, params["theater_name"]);
 
 	std::string result;
-	if (sqlite3_step(stmt) == SQLITE_DONE) {
-		int theater_id = sqlite3_last_insert_rowid(db); // This prolly needs to be changed
-		result = "{\"request\": \"0\", \"message\": \"Success!\", \"theater_id\": \"" + std::to_string(theater_id) + "\"}";
+	if (stmt.step() == SQLITE_DONE) {
+		JsonWriter json;
+		success(json).field("theater_id", (int64_t)sqlite3_last_insert_rowid(conn.db)).endObject();
+		result = json.take();
+		refreshCatalog();
 	} else result = "{\"request\": \"1\", \"message\": \"Failed to add theater.\"}";
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
-
 	return result;
 }
 
@@ -1242,38 +1521,24 @@ std::string addTheater(std::map<std::string, std::string> params) {
  * Returns:
  * - Fail/Success
  */
-std::string delTheater(std::map<std::string, std::string> params) {
-    DBG_PRINT("User called addtheater\n");
-	sqlite3 *db;
-	int rc = sqlite3_open(DATABASE_FILE, &db);
-
-	if (!params.count("email") || !params.count("password") || !params.count("theater_id")) { // if ANY of these dont exist, returns error
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs \'email\', \'password\', and \'theater_id\'\"}";
-	}
-
-    // Check if user is admin
-    if(!isAdmin(params["email"], params["password"], db))
-		return "{\"request\": \"1\", \"message\": \"Permission denied.\"}";
-
-	std::string sql = "DELETE FROM Theaters WHERE id = ?";
-	sqlite3_stmt *stmt = nullptr;
+std::string delTheater(Connection &conn, const QueryParams &params, const Caller &) {
+    DBG_PRINT("User called deltheater\n");
 
-	if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		sqlite3_close(db);
+	Statement stmt(conn, Stmt::DeleteTheater);
+	if (!stmt) {
 		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
 	}
 
-	sqlite3_bind_text(stmt, 1, params["theater_id"].c_str(), -1, SQLITE_TRANSIENT);
+	stmt.bind(1, params["theater_id"]);
 
 	std::string result;
-	if (sqlite3_step(stmt) == SQLITE_DONE) {
-		result = "{\"request\": \"0\", \"message\": \"Success!\"}";
+	if (stmt.step() == SQLITE_DONE) {
+		JsonWriter json;
+		success(json).endObject();
+		result = json.take();
+		refreshCatalog();
 	} else result = "{\"request\": \"1\", \"message\": \"Failed to delete theater.\"}";
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
-
 	return result;
 }
 
@@ -1285,36 +1550,15 @@ std::string delTheater(std::map<std::string, std::string> params) {
  * - Fail/Success
  * - Theater ID
  */
-std::string getTheater(std::map<std::string, std::string> params) {
-    DBG_PRINT("User called addtheater\n");
-	sqlite3 *db;
-	int rc = sqlite3_open(DATABASE_FILE, &db);
-
-	if (!params.count("theater_name")) { // if ANY of these dont exist, returns error
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs \'email\', \'password\', and \'theater_id\'\"}";
-	}
-
-	std::string sql = "SELECT id FROM Theaters WHERE name = ?";
-	sqlite3_stmt *stmt = nullptr;
-
-	if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
-	}
-
-	sqlite3_bind_text(stmt, 1, params["theater_name"].c_str(), -1, SQLITE_TRANSIENT);
+std::string getTheater(Connection &, const QueryParams &params, const Caller &) {
+    DBG_PRINT("User called gettheater\n");
 
-	std::string result;
-	if (sqlite3_step(stmt) == SQLITE_ROW) {
-        std::string entries = std::string((const char*)sqlite3_column_text(stmt,0));
-		result = "{\"request\": \"0\", \"message\": \"Success!\", \"id\": \"" + entries + "\"}";
-	} else result = "{\"request\": \"1\", \"message\": \"Failed to find theater.\"}";
+	const CatalogTheater *theater = catalog.snapshot().theater(params["theater_name"]);
+	if (!theater) return "{\"request\": \"1\", \"message\": \"Failed to find theater.\"}";
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
-
-	return result;
+	JsonWriter json;
+	success(json).field("id", theater->id).endObject();
+	return json.take();
 }
 
 /*
@@ -1327,98 +1571,306 @@ std::string getTheater(std::map<std::string, std::string> params) {
  * - Fail/Success
  * - Admin Report
  */
-std::string genReport(std::map<std::string, std::string> params) {
+std::string genReport(Connection &conn, const QueryParams &params, const Caller &) {
     DBG_PRINT("User called genreport\n");
-	sqlite3 *db;
-    std::string sql;
-	int rc = sqlite3_open(DATABASE_FILE, &db);
 
-	if (!params.count("email") || !params.count("password")) { // if ANY of these dont exist, returns error
-		sqlite3_close(db);
-		return "{\"request\": \"1\", \"message\": \"Missing fields: Needs \'email\', \'password\', and \'theater_name\'\"}";
+	// Paged by revenue, highest first, then movie id. The cursor is both.
+	Page page;
+	double afterRevenue = HUGE_VAL;
+	int64_t afterMovie = 0;
+	if (!page.parse(params, 2))
+		return "{\"request\": \"1\", \"message\": \"Invalid page.\"}";
+	if (!page.after.empty()) {
+		char *end;
+		afterRevenue = strtod(page.after[0].c_str(), &end);
+		auto movie = parseId(page.after[1]);
+		if (page.after[0].empty() || *end || !movie)
+			return "{\"request\": \"1\", \"message\": \"Invalid page.\"}";
+		afterMovie = *movie;
 	}
 
-    // Check if user is admin
-    if(!isAdmin(params["email"], params["password"], db))
-		return "{\"request\": \"1\", \"message\": \"Permission denied.\"}";
-
-    if(!params.count("theater_id")) {
-        sql = R"(
-            SELECT M.name, SUM(T.quantity) AS 'tickets_sold', SUM(T.id * M.price_per_ticket) AS 'total_revenue'
-                FROM Movies M
-                    INNER JOIN Tickets T ON M.id = T.movie_id
-                    INNER JOIN Theaters H ON H.id = M.theater_id
-                GROUP BY M.name
-                ORDER BY total_revenue DESC;
-        )";
-    } else {
-        sql = R"(
-            SELECT H.name AS 'theater', M.name, SUM(T.quantity) AS 'tickets_sold', SUM(T.id * M.price_per_ticket) AS 'total_revenue'
-                FROM Movies M
-                    INNER JOIN Tickets T ON M.id = T.movie_id
-                    INNER JOIN Theaters H ON H.id = M.theater_id
-                WHERE H.id = ?
-                GROUP BY M.name
-                ORDER BY total_revenue DESC;
-        )";
-    }
-
-	sqlite3_stmt *stmt = nullptr;
-
-	if ((rc =sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr)) != SQLITE_OK) {
-        std::cout << rc << "\n";
-        std::cout << sql << "\n";
-		sqlite3_close(db);
+	Statement stmt(conn, params.count("theater_id") ? Stmt::ReportByTheater : Stmt::Report);
+	if (!stmt) {
 		return "{\"request\": \"1\", \"message\": \"Failed to prepare statement.\"}";
 	}
 
+	sqlite3_bind_double(stmt, 1, afterRevenue);
+	sqlite3_bind_int64(stmt, 2, afterMovie);
+	sqlite3_bind_int64(stmt, 3, (int64_t)page.limit + 1);
     if(params.count("theater_id")) 
-	    sqlite3_bind_text(stmt, 1, params["theater_id"].c_str(), -1, SQLITE_TRANSIENT);
+	    stmt.bind(4, params["theater_id"]);
 
     std::string result;
-    rc = sqlite3_step(stmt);
-    if (rc == SQLITE_ROW) {
-        std::string entries = parseSelect(stmt);
-        result = "{\"request\": \"0\", \"message\": \"Success!\", \"report\": " + entries + "}";
+    if (stmt.step() == SQLITE_ROW) {
+        JsonWriter json(4096);
+        // In either report movie_id is first and total_revenue is last
+        pageRows(success(json), "report", stmt, page.limit, [](sqlite3_stmt *row) {
+            char revenue[32];
+            snprintf(revenue, sizeof(revenue), "%.17g", sqlite3_column_double(row, sqlite3_column_count(row) - 1));
+            return makeCursor({revenue, std::to_string(sqlite3_column_int64(row, 0))});
+        }).endObject();
+        result = json.take();
     } else {
         result = "{\"request\": \"1\", \"message\": \"Failed to generate report.\"}";
     }
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
-
 	return result;
 
 }
 
+/*
+ * Requirements:
+ * - Email (with admin permissions)
+ * - Password
+ *
+ * Returns:
+ * - Fail/Success
+ * - Server counters
+ */
+std::string serverStats(Connection &, const QueryParams &, const Caller &) {
+    DBG_PRINT("User called stats\n");
+
+	PasswordHashStats hashes = passwordHashStats();
+	WritePipeline::Stats writes = writePipeline.stats();
+	CompressionStats compression = compressionStats();
+
+	JsonWriter json;
+	success(json).key("stats").beginObject()
+		.field("statement_cache_hits", dbReaders.cacheHits() + dbWriter.cacheHits())
+		.field("statement_cache_misses", dbReaders.cacheMisses() + dbWriter.cacheMisses())
+		.field("sessions", (uint64_t)sessions.size())
+		.field("hash_queue_depth", (uint64_t)hashPool.queued())
+		.field("hash_rejected", hashPool.jobsRejected())
+		.field("hash_count", hashes.count)
+		.field("hash_avg_us", hashes.count ? hashes.totalMicros / hashes.count : 0)
+		.field("hash_max_us", hashes.maxMicros)
+		.field("not_modified", notModified.load(std::memory_order_relaxed))
+		.field("compressed_responses", compression.responses)
+		.field("compressed_bytes_in", compression.bytesIn)
+		.field("compressed_bytes_out", compression.bytesOut)
+		.field("compressed_cache_hits", compression.cacheHits)
+		.field("write_queue_depth", (uint64_t)writePipeline.queued())
+		.field("write_batches", writes.batches)
+		.field("writes", writes.writes)
+		.field("write_failed_batches", writes.failedBatches)
+		.field("write_batch_avg", writes.batches ? (double)writes.writes / writes.batches : 0.0)
+		.field("write_batch_max", writes.maxBatch)
+		.field("write_commit_avg_us", writes.batches ? writes.totalCommitMicros / writes.batches : 0)
+		.field("write_commit_max_us", writes.maxCommitMicros)
+		.endObject().endObject();
+	return json.take();
+}
+
+/*
+ * Requirements:
+ * - Email (with admin permissions)
+ * - Password
+ *
+ * Returns:
+ * - Fail/Success
+ * - Traced requests, in Chrome's trace event format (save the response and
+ *   open it in chrome://tracing or Perfetto)
+ */
+std::string traceDump(Connection &, const QueryParams &, const Caller &) {
+    DBG_PRINT("User called trace\n");
+
+	JsonWriter json(65536);
+	success(json).field("displayTimeUnit", "ms").key("traceEvents");
+	tracer.render(json);
+	json.endObject();
+	return json.take();
+}
+
+// The microbenchmarks link everything above this line without the entry point
+#ifndef MBS_NO_MAIN
+
+//################################################
+// command line
+
+// Long-only options
+enum {
+	OPT_SYNCHRONOUS = 256,
+	OPT_CACHE_SIZE,
+	OPT_MMAP_SIZE,
+	OPT_BUSY_TIMEOUT,
+	OPT_SESSION_TTL,
+	OPT_HASH_COST,
+	OPT_HASH_THREADS,
+	OPT_HASH_QUEUE,
+	OPT_BATCH_SIZE,
+	OPT_BATCH_WINDOW,
+	OPT_COMPRESS_MIN,
+	OPT_COMPRESS_LEVEL,
+	OPT_COMPRESS_CACHE,
+	OPT_TRACE_RATE,
+	OPT_TRACE_SLOW,
+	OPT_TRACE_BUFFER,
+};
+
+static struct argp_option options[] = {
+	{"port",    'p', "PORT", 0, "Port to listen on (default: 4444)", 0},
+	{"threads", 't', "N",    0, "Number of threads serving requests (default: all cores)", 0},
+	{"idle-timeout", 'i', "SECONDS", 0, "Close kept-alive connections after this long idle (default: 30)", 0},
+	{"db-connections", 'c', "N", 0, "Number of read-only database connections, at least one per request and hashing thread (default: that many)", 0},
+	{"synchronous",  OPT_SYNCHRONOUS,  "MODE",  0, "SQLite synchronous level: OFF, NORMAL or FULL (default: NORMAL)", 0},
+	{"cache-size",   OPT_CACHE_SIZE,   "KIB",   0, "SQLite page cache per connection in KiB (default: 16384)", 0},
+	{"mmap-size",    OPT_MMAP_SIZE,    "BYTES", 0, "SQLite memory-mapped I/O size in bytes (default: 268435456)", 0},
+	{"busy-timeout", OPT_BUSY_TIMEOUT, "MS",    0, "Milliseconds to wait on a locked database (default: 5000)", 0},
+	{"session-ttl",  OPT_SESSION_TTL,  "SECONDS", 0, "How long a verifyacc token stays valid (default: 3600)", 0},
+	{"hash-cost",    OPT_HASH_COST,    "LOG2N", 0, "scrypt cost for new password hashes, as a power of two (default: 14)", 0},
+	{"hash-threads", OPT_HASH_THREADS, "N",     0, "Threads hashing passwords (default: half the request threads)", 0},
+	{"hash-queue",   OPT_HASH_QUEUE,   "N",     0, "Logins allowed to wait for a hashing thread (default: 1024)", 0},
+	{"batch-size",   OPT_BATCH_SIZE,   "N",     0, "Most writes committed together in one transaction (default: 64)", 0},
+	{"batch-window", OPT_BATCH_WINDOW, "US",    0, "Microseconds a write waits for others to join its batch (default: 2000)", 0},
+	{"compress-min", OPT_COMPRESS_MIN, "BYTES", 0, "Smallest response body worth compressing (default: 1024)", 0},
+	{"compress-level", OPT_COMPRESS_LEVEL, "N", 0, "zlib compression level, 1 to 9 (default: 6)", 0},
+	{"compress-cache", OPT_COMPRESS_CACHE, "N", 0, "Compressed responses kept for reuse, 0 to turn off (default: 1024)", 0},
+	{"trace-rate",   OPT_TRACE_RATE,   "SHARE", 0, "Share of requests to trace, 0 to 1 (default: 0)", 0},
+	{"trace-slow",   OPT_TRACE_SLOW,   "US",    0, "Always trace requests at least this many microseconds long, 0 to turn off (default: 0)", 0},
+	{"trace-buffer", OPT_TRACE_BUFFER, "N",     0, "Traced requests kept per thread (default: 1024)", 0},
+	{0, 0, 0, 0, 0, 0}
+};
+
+static error_t parseOpt(int key, char *arg, struct argp_state *state) {
+	switch (key) {
+		case 'p':
+			config.port = (unsigned short)atoi(arg);
+			break;
+		case 't':
+			if (atoi(arg) < 1) argp_error(state, "threads must be at least 1");
+			config.threads = atoi(arg);
+			break;
+		case 'i':
+			if (atoi(arg) < 1) argp_error(state, "idle timeout must be at least 1 second");
+			config.idle_timeout = atoi(arg);
+			break;
+		case 'c':
+			if (atoi(arg) < 1) argp_error(state, "db-connections must be at least 1");
+			config.db_connections = atoi(arg);
+			break;
+		case OPT_SYNCHRONOUS:
+			config.synchronous = arg;
+			for (auto &c : config.synchronous) c = toupper(c);
+			if (config.synchronous != "OFF" && config.synchronous != "NORMAL" && config.synchronous != "FULL")
+				argp_error(state, "synchronous must be OFF, NORMAL or FULL");
+			break;
+		case OPT_CACHE_SIZE:
+			config.cache_size = strtoul(arg, nullptr, 10);
+			break;
+		case OPT_MMAP_SIZE:
+			config.mmap_size = strtoull(arg, nullptr, 10);
+			break;
+		case OPT_BUSY_TIMEOUT:
+			config.busy_timeout = strtoul(arg, nullptr, 10);
+			break;
+		case OPT_SESSION_TTL:
+			if (atoi(arg) < 1) argp_error(state, "session ttl must be at least 1 second");
+			config.session_ttl = atoi(arg);
+			break;
+		case OPT_HASH_COST:
+			if (atoi(arg) < 10 || atoi(arg) > 20) argp_error(state, "hash cost must be between 10 and 20");
+			config.hash_cost = atoi(arg);
+			break;
+		case OPT_HASH_THREADS:
+			if (atoi(arg) < 1) argp_error(state, "hash-threads must be at least 1");
+			config.hash_threads = atoi(arg);
+			break;
+		case OPT_HASH_QUEUE:
+			if (atoi(arg) < 1) argp_error(state, "hash-queue must be at least 1");
+			config.hash_queue = atoi(arg);
+			break;
+		case OPT_BATCH_SIZE:
+			if (atoi(arg) < 1) argp_error(state, "batch-size must be at least 1");
+			config.batch_size = atoi(arg);
+			break;
+		case OPT_BATCH_WINDOW:
+			if (atoi(arg) < 0) argp_error(state, "batch-window can't be negative");
+			config.batch_window = atoi(arg);
+			break;
+		case OPT_COMPRESS_MIN:
+			if (atoi(arg) < 0) argp_error(state, "compress-min can't be negative");
+			config.compress_min = atoi(arg);
+			break;
+		case OPT_COMPRESS_LEVEL:
+			if (atoi(arg) < 1 || atoi(arg) > 9) argp_error(state, "compress-level must be between 1 and 9");
+			config.compress_level = atoi(arg);
+			break;
+		case OPT_COMPRESS_CACHE:
+			if (atoi(arg) < 0) argp_error(state, "compress-cache can't be negative");
+			config.compress_cache = atoi(arg);
+			break;
+		case OPT_TRACE_RATE:
+			if (atof(arg) < 0 || atof(arg) > 1) argp_error(state, "trace-rate must be between 0 and 1");
+			config.trace_rate = atof(arg);
+			break;
+		case OPT_TRACE_SLOW:
+			if (atoi(arg) < 0) argp_error(state, "trace-slow can't be negative");
+			config.trace_slow = atoi(arg);
+			break;
+		case OPT_TRACE_BUFFER:
+			if (atoi(arg) < 0) argp_error(state, "trace-buffer can't be negative");
+			config.trace_buffer = atoi(arg);
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp argParser = {options, parseOpt, 0, "Movie booking system backend", 0, 0, 0};
+
 //################################################
 int main(int argc, char* argv[]) {
     fprintf(stderr, "\x1b[31;1mWARNING\x1b[0;0m: THIS IS NOT PRODUCTION READY CODE!!!\n");
-    
+	argp_parse(&argParser, argc, argv, 0, 0, 0);
+	if (!config.hash_threads) config.hash_threads = std::max(1u, config.threads / 2);
+
+	// Every thread that reads holds one connection at a time, so with one
+	// each an io thread never waits in acquire() and stalls its sockets
+	unsigned int readers = config.threads + config.hash_threads;
+	if (config.db_connections && config.db_connections < readers)
+		std::cerr << "Raising db-connections to " << readers << ", one per request and hashing thread\n";
+	config.db_connections = std::max(config.db_connections, readers);
+
 	try {
-		asio::io_context ioc;
+		asio::io_context ioc(config.threads);
 
 		int sqlData = sqLiteInitialize();
 		if(sqlData == 1) {
 			return(1);
 		}
 
-		tcp::acceptor acceptor(ioc, {tcp::v4(), PORT});
-		std::cout << "Server listening on http://localhost:" << std::to_string(PORT) << "/\n";
-		
-		for (;;) {
-			tcp::socket socket(ioc);
-			acceptor.accept(socket);
-
-			beast::flat_buffer buffer;
-			http::request<http::string_body> req;
-			http::read(socket, buffer, req);
-
-			http::response<http::string_body> res;
-			handleRequest(req, res);
-
-			http::write(socket, res);
-		}
+		// Everything else in memory only changes once a batch has committed,
+		// but seats are taken before; a failed batch gives its seats back here,
+		// and moves the Seats version on so no tag vouches for the counts a
+		// read may have seen in between. Nothing else it touched has changed.
+		// Replies go back to the io threads to be built and sent.
+		writePipeline.start(dbWriter, [](Connection &conn) {
+			seats.load(conn);
+			tableVersions.bump(Tables::Seats);
+		}, [&ioc](std::function<void()> job) {
+			asio::post(ioc, std::move(job));
+		});
+		hashPool.start(config.hash_threads, config.hash_queue);
+
+		std::make_shared<Listener>(ioc, tcp::endpoint(tcp::v4(), config.port))->run();
+		std::cout << "Server listening on http://localhost:" << std::to_string(config.port) << "/ (" << config.threads << " threads)\n";
+
+		// Stop cleanly on ctrl-c
+		asio::signal_set signals(ioc, SIGINT, SIGTERM);
+		signals.async_wait([&](beast::error_code const&, int) { ioc.stop(); });
+
+		std::vector<std::thread> workers;
+		workers.reserve(config.threads - 1);
+		for (unsigned int i = 1; i < config.threads; i++)
+			workers.emplace_back([&ioc] { ioc.run(); });
+		ioc.run();
+
+		for (auto &worker : workers) worker.join();
+		// Jobs still running finish before ioc goes away
+		hashPool.stop();
+		// After the hashing threads, which may still queue writes
+		writePipeline.stop();
 	} catch (const std::exception& exception) {
 		std::cerr << "Error: " << exception.what() << "\n";
 		return(1);
@@ -1426,3 +1878,5 @@ int main(int argc, char* argv[]) {
 	return(0);
 	
 }
+
+#endif // MBS_NO_MAIN
@@ -1,35 +1,76 @@
 #pragma once
 #include "Util.h"
+#include "Config.h"
+#include "Server.h"
+#include "Database.h"
+#include "Schema.h"
+#include "Query.h"
+#include "Json.h"
+#include "Catalog.h"
+#include "Session.h"
+#include "Password.h"
+#include "WorkerPool.h"
+#include "Seats.h"
+#include "WritePipeline.h"
+#include "Versions.h"
+#include "Compress.h"
+#include "Metrics.h"
+#include "Trace.h"
 
-namespace beast = boost::beast;
-namespace http = beast::http;
-namespace asio = boost::asio;
-using tcp = asio::ip::tcp;
+// Who may call an action. User and Admin need a token or email/password,
+// Login needs email/password and ignores any token sent with them.
+enum class Auth { None, User, Admin, Login };
 
-std::map<std::string, std::string> parseQuery(const std::string& query);
-void handleRequest(http::request<http::string_body> req, http::response<http::string_body>& res);
-static int sqLiteCallback(void *NotUsed, int argc, char **argv, char **azColName);
+/*
+ * An entry in the action table. required holds up to seven parameter names,
+ * unused entries are left empty. The login is checked before the handler
+ * is called, so it isn't listed there.
+ *
+ * needsConnection is false for reads answered from memory alone (the
+ * catalog, sessions, counters). They are handed an unopened connection
+ * instead of waiting for a reader.
+ *
+ * tables is what a read's response depends on, which gives it an ETag, or
+ * what a write changes, whose versions move on once it has committed.
+ */
+struct Action {
+	std::string_view name;
+	std::string (*handler)(Connection &conn, const QueryParams &params, const Caller &caller);
+	bool readOnly;
+	bool needsConnection;
+	Auth auth;
+	std::string_view required[7];
+	unsigned int tables = 0; // Tables:: bits, see Versions.h
+};
+
+const Action *findAction(std::string_view name);
+// Fills in res and then calls done, either straight away or later from hashPool.
+// trace, if given, gets the stages of the request up to the response being ready.
+void handleRequest(const http::request<http::string_body> &req, http::response<http::string_body>& res, std::function<void()> done, RequestTrace *trace = nullptr);
 bool sqLiteExecute(sqlite3 *db, const std::string &sql);
 int sqLiteInitialize();
-static int makeDefaultAdmin(sqlite3 *db);
 
-std::string createAcc(std::map<std::string, std::string> params); // to be changed
-std::string deleteAcc(std::map<std::string, std::string> params);
-std::string buyTicket(std::map<std::string, std::string> params);
-std::string getTicket(std::map<std::string, std::string> params);
-std::string adminAdd(std::map<std::string, std::string> params);
-std::string adminDel(std::map<std::string, std::string> params);
-std::string addMovie(std::map<std::string, std::string> params);
-std::string delMovie(std::map<std::string, std::string> params);
-std::string accDetails(std::map<std::string, std::string> params);
-std::string listMovies(std::map<std::string, std::string> params);
-std::string verifyAcc(std::map<std::string, std::string> params);
-std::string getMovie(std::map<std::string, std::string> params);
-std::string adminVerify(std::map<std::string, std::string> params);
-std::string reviewAdd(std::map<std::string, std::string> params);
-std::string reviewList(std::map<std::string, std::string> params);
-std::string addTheater(std::map<std::string, std::string> params);
-std::string delTheater(std::map<std::string, std::string> params);
-std::string getTheater(std::map<std::string, std::string> params);
-std::string genReport(std::map<std::string, std::string> params);
-std::string updatePayment(std::map<std::string, std::string> params);
+std::string createAcc(Connection &conn, const QueryParams &params, const Caller &caller); // to be changed
+std::string deleteAcc(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string buyTicket(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string getTicket(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string adminAdd(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string adminDel(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string addMovie(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string delMovie(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string accDetails(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string listMovies(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string verifyAcc(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string getMovie(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string adminVerify(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string reviewAdd(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string reviewList(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string search(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string addTheater(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string delTheater(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string getTheater(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string genReport(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string updatePayment(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string logout(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string serverStats(Connection &conn, const QueryParams &params, const Caller &caller);
+std::string traceDump(Connection &conn, const QueryParams &params, const Caller &caller);
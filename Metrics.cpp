@@ -0,0 +1,136 @@
+#include "Metrics.h"
+
+Metrics metrics;
+
+Metrics::ThreadCounters &Metrics::mine() {
+	thread_local ThreadCounters *counters = nullptr;
+	if (!counters) {
+		auto made = std::make_unique<ThreadCounters>();
+		counters = made.get();
+		std::lock_guard<std::mutex> guard(lock);
+		threads.push_back(std::move(made));
+	}
+	return *counters;
+}
+
+void Metrics::requestStarted() {
+	mine().started.add(1);
+}
+
+void Metrics::requestFinished(size_t action, bool failed, Clock::time_point started) {
+	uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started).count();
+	size_t bucket = std::lower_bound(std::begin(latencyBounds), std::end(latencyBounds), micros) - std::begin(latencyBounds);
+
+	ThreadCounters &counters = mine();
+	ActionCounters &entry = counters.actions[action];
+	entry.requests.add(1);
+	if (failed) entry.failures.add(1);
+	entry.micros.add(micros);
+	entry.buckets[bucket].add(1);
+	counters.finished.add(1);
+}
+
+void Metrics::sqlTime(Sql phase, uint64_t nanos) {
+	ThreadCounters &counters = mine();
+	counters.sqlCalls[(int)phase].add(1);
+	counters.sqlNanos[(int)phase].add(nanos);
+}
+
+int timedStep(sqlite3_stmt *stmt) {
+	auto start = Metrics::Clock::now();
+	int rc = sqlite3_step(stmt);
+	metrics.sqlTime(Metrics::Sql::Step, std::chrono::duration_cast<std::chrono::nanoseconds>(Metrics::Clock::now() - start).count());
+	return rc;
+}
+
+//################################################
+// exposition
+
+static void writeSeconds(std::string &out, double seconds) {
+	char number[32];
+	snprintf(number, sizeof(number), "%.9g", seconds);
+	out += number;
+}
+
+std::string Metrics::render(const std::vector<std::string_view> &actionNames) {
+	size_t actionCount = std::min(actionNames.size(), maxActions);
+	uint64_t started = 0, finished = 0;
+	uint64_t sqlCalls[3] = {}, sqlNanos[3] = {};
+	std::vector<uint64_t> requests(actionCount), failures(actionCount), micros(actionCount);
+	std::vector<std::array<uint64_t, bucketCount>> buckets(actionCount);
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (auto &thread : threads) {
+			// Finished first, so a request caught in between is never negative in flight
+			finished += thread->finished.get();
+			started += thread->started.get();
+			for (int phase = 0; phase < 3; phase++) {
+				sqlCalls[phase] += thread->sqlCalls[phase].get();
+				sqlNanos[phase] += thread->sqlNanos[phase].get();
+			}
+			for (size_t i = 0; i < actionCount; i++) {
+				ActionCounters &entry = thread->actions[i];
+				requests[i] += entry.requests.get();
+				failures[i] += entry.failures.get();
+				micros[i] += entry.micros.get();
+				for (size_t b = 0; b < bucketCount; b++) buckets[i][b] += entry.buckets[b].get();
+			}
+		}
+	}
+
+	std::string out;
+	out.reserve(4096 + actionCount * 2048);
+
+	out += "# HELP mbs_requests_total Requests answered, by action.\n";
+	out += "# TYPE mbs_requests_total counter\n";
+	for (size_t i = 0; i < actionCount; i++) {
+		out += "mbs_requests_total{action=\"";
+		out += actionNames[i];
+		out += "\"} " + std::to_string(requests[i]) + "\n";
+	}
+
+	out += "# HELP mbs_request_errors_total Requests not answered with \"request\": \"0\", by action.\n";
+	out += "# TYPE mbs_request_errors_total counter\n";
+	for (size_t i = 0; i < actionCount; i++) {
+		out += "mbs_request_errors_total{action=\"";
+		out += actionNames[i];
+		out += "\"} " + std::to_string(failures[i]) + "\n";
+	}
+
+	out += "# HELP mbs_request_duration_seconds Time from a request being read to its response being ready to send, by action.\n";
+	out += "# TYPE mbs_request_duration_seconds histogram\n";
+	for (size_t i = 0; i < actionCount; i++) {
+		std::string label = "action=\"" + std::string(actionNames[i]) + "\"";
+		uint64_t cumulative = 0;
+		for (size_t b = 0; b < bucketCount; b++) {
+			cumulative += buckets[i][b];
+			out += "mbs_request_duration_seconds_bucket{" + label + ",le=\"";
+			if (b + 1 < bucketCount) writeSeconds(out, latencyBounds[b] / 1e6);
+			else out += "+Inf";
+			out += "\"} " + std::to_string(cumulative) + "\n";
+		}
+		out += "mbs_request_duration_seconds_sum{" + label + "} ";
+		writeSeconds(out, micros[i] / 1e6);
+		out += "\nmbs_request_duration_seconds_count{" + label + "} " + std::to_string(requests[i]) + "\n";
+	}
+
+	out += "# HELP mbs_requests_in_flight Requests read but not yet answered.\n";
+	out += "# TYPE mbs_requests_in_flight gauge\n";
+	out += "mbs_requests_in_flight " + std::to_string(started > finished ? started - finished : 0) + "\n";
+
+	static const char *const phases[] = {"prepare", "step", "finalize"};
+	out += "# HELP mbs_sqlite_seconds_total Time spent in SQLite, by phase.\n";
+	out += "# TYPE mbs_sqlite_seconds_total counter\n";
+	for (int phase = 0; phase < 3; phase++) {
+		out += "mbs_sqlite_seconds_total{phase=\"" + std::string(phases[phase]) + "\"} ";
+		writeSeconds(out, sqlNanos[phase] / 1e9);
+		out += "\n";
+	}
+	out += "# HELP mbs_sqlite_calls_total Calls to SQLite, by phase. Step is one call per row.\n";
+	out += "# TYPE mbs_sqlite_calls_total counter\n";
+	for (int phase = 0; phase < 3; phase++) {
+		out += "mbs_sqlite_calls_total{phase=\"" + std::string(phases[phase]) + "\"} " + std::to_string(sqlCalls[phase]) + "\n";
+	}
+	return out;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "Util.h"
+
+/*
+ * Counters behind the /metrics endpoint: requests, failures and a latency
+ * histogram per action, requests in flight, and time spent in SQLite split
+ * into preparing, stepping and resetting or finalizing statements.
+ *
+ * Every thread counts into its own block, so recording is a few plain
+ * stores with no lock and no shared cache line. The blocks are only added
+ * up when /metrics is scraped. A thread's block outlives it, so nothing
+ * counted is lost when a thread exits.
+ *
+ * Actions are numbered by whoever records them; render() is given their
+ * names in the same order.
+ */
+class Metrics {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr size_t maxActions = 64;
+	// Upper bounds of the latency buckets in µs, the last bucket is +Inf
+	static constexpr uint64_t latencyBounds[] = {
+		100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000,
+	};
+	static constexpr size_t bucketCount = sizeof(latencyBounds) / sizeof(latencyBounds[0]) + 1;
+
+	enum class Sql { Prepare, Step, Finalize };
+
+	void requestStarted();
+	// action must be below maxActions
+	void requestFinished(size_t action, bool failed, Clock::time_point started);
+	void sqlTime(Sql phase, uint64_t nanos);
+
+	// Prometheus text exposition format
+	std::string render(const std::vector<std::string_view> &actionNames);
+
+private:
+	// Written only by the thread that owns it, read by render()
+	struct Counter {
+		std::atomic<uint64_t> value{0};
+		void add(uint64_t n) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+		uint64_t get() const { return value.load(std::memory_order_relaxed); }
+	};
+	struct ActionCounters {
+		Counter requests;
+		Counter failures;
+		Counter micros;
+		Counter buckets[bucketCount];
+	};
+	struct alignas(64) ThreadCounters {
+		Counter started;
+		Counter finished;
+		Counter sqlCalls[3];
+		Counter sqlNanos[3];
+		ActionCounters actions[maxActions];
+	};
+
+	std::mutex lock;
+	std::vector<std::unique_ptr<ThreadCounters>> threads;
+
+	ThreadCounters &mine();
+};
+
+extern Metrics metrics;
+
+// sqlite3_step(), with the time it takes counted
+int timedStep(sqlite3_stmt *stmt);
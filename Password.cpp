@@ -0,0 +1,127 @@
+#include "Password.h"
+#include "Config.h"
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+
+static constexpr std::string_view prefix = "scrypt$";
+static constexpr size_t saltBytes = 16;
+static constexpr size_t hashBytes = 32;
+
+static std::atomic<uint64_t> hashCount{0};
+static std::atomic<uint64_t> hashTotalMicros{0};
+static std::atomic<uint64_t> hashMaxMicros{0};
+
+static std::string toHex(const uint8_t *data, size_t size) {
+	static const char hex[] = "0123456789abcdef";
+	std::string text;
+	text.reserve(size * 2);
+	for (size_t i = 0; i < size; i++) {
+		text += hex[data[i] >> 4];
+		text += hex[data[i] & 0xf];
+	}
+	return text;
+}
+
+static inline int hexValue(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	return -1;
+}
+
+static bool fromHex(std::string_view text, std::vector<uint8_t> &out) {
+	if (text.size() % 2) return(false);
+	out.resize(text.size() / 2);
+	for (size_t i = 0; i < out.size(); i++) {
+		int high = hexValue(text[i * 2]);
+		int low = hexValue(text[i * 2 + 1]);
+		if (high < 0 || low < 0) return(false);
+		out[i] = (uint8_t)(high << 4 | low);
+	}
+	return(true);
+}
+
+static bool parseNumber(std::string_view text, unsigned int &value) {
+	auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+	return ec == std::errc() && end == text.data() + text.size();
+}
+
+/*
+ * One scrypt run, timed for the stats. maxmem has to be raised by hand,
+ * OpenSSL refuses anything over 32 MiB otherwise.
+ */
+static bool scrypt(std::string_view password, const uint8_t *salt, size_t saltSize,
+	unsigned int logN, unsigned int r, unsigned int p, uint8_t *out, size_t outSize) {
+	if (logN < 1 || logN > 30 || r < 1 || p < 1) return(false);
+
+	uint64_t N = 1ull << logN;
+	uint64_t maxmem = 128ull * r * N * (p + 1) + (1u << 20);
+
+	auto start = std::chrono::steady_clock::now();
+	int ok = EVP_PBE_scrypt(password.data(), password.size(), salt, saltSize, N, r, p, maxmem, out, outSize);
+	uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+	hashCount.fetch_add(1, std::memory_order_relaxed);
+	hashTotalMicros.fetch_add(micros, std::memory_order_relaxed);
+	uint64_t seen = hashMaxMicros.load(std::memory_order_relaxed);
+	while (micros > seen && !hashMaxMicros.compare_exchange_weak(seen, micros, std::memory_order_relaxed));
+
+	return ok == 1;
+}
+
+std::string hashPassword(std::string_view password) {
+	const unsigned int r = 8, p = 1;
+
+	uint8_t salt[saltBytes];
+	uint8_t hash[hashBytes];
+	if (RAND_bytes(salt, sizeof(salt)) != 1) return std::string();
+	if (!scrypt(password, salt, sizeof(salt), config.hash_cost, r, p, hash, sizeof(hash))) return std::string();
+
+	return std::string(prefix) + std::to_string(config.hash_cost) + "$" + std::to_string(r) + "$" + std::to_string(p) +
+		"$" + toHex(salt, sizeof(salt)) + "$" + toHex(hash, sizeof(hash));
+}
+
+bool isPasswordHash(std::string_view stored) {
+	return stored.substr(0, prefix.size()) == prefix;
+}
+
+bool verifyPassword(std::string_view password, std::string_view stored) {
+	if (!isPasswordHash(stored)) {
+		return password.size() == stored.size() && CRYPTO_memcmp(password.data(), stored.data(), stored.size()) == 0;
+	}
+
+	// logN $ r $ p $ salt $ hash
+	std::string_view fields[5];
+	std::string_view rest = stored.substr(prefix.size());
+	for (size_t i = 0; i < 5; i++) {
+		size_t end = i < 4 ? rest.find('$') : rest.size();
+		if (end == std::string_view::npos) return(false);
+		fields[i] = rest.substr(0, end);
+		rest.remove_prefix(i < 4 ? end + 1 : end);
+	}
+
+	unsigned int logN, r, p;
+	std::vector<uint8_t> salt, expected;
+	if (!parseNumber(fields[0], logN) || !parseNumber(fields[1], r) || !parseNumber(fields[2], p) ||
+		!fromHex(fields[3], salt) || !fromHex(fields[4], expected) || expected.empty()) {
+		return(false);
+	}
+
+	std::vector<uint8_t> actual(expected.size());
+	if (!scrypt(password, salt.data(), salt.size(), logN, r, p, actual.data(), actual.size())) return(false);
+	return CRYPTO_memcmp(actual.data(), expected.data(), expected.size()) == 0;
+}
+
+void verifyNoPassword(std::string_view password) {
+	// Made once, on the first miss; that one login costs an extra hash
+	static const std::string dummy = hashPassword("no such account");
+	verifyPassword(password, dummy);
+}
+
+PasswordHashStats passwordHashStats() {
+	return {
+		hashCount.load(std::memory_order_relaxed),
+		hashTotalMicros.load(std::memory_order_relaxed),
+		hashMaxMicros.load(std::memory_order_relaxed),
+	};
+}
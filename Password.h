@@ -0,0 +1,33 @@
+#pragma once
+#include "Util.h"
+
+/*
+ * Salted scrypt password hashes, stored as
+ *
+ *   scrypt$<log2 N>$<r>$<p>$<salt hex>$<hash hex>
+ *
+ * The cost is kept in the string, so hashes made before config.hash_cost was
+ * changed still verify. Both calls take tens of milliseconds on purpose;
+ * run them on hashPool, never on an io_context thread.
+ */
+
+// Empty if hashing failed (out of memory or no random bytes)
+std::string hashPassword(std::string_view password);
+
+// Anything not in the format above is a password from before hashing and
+// is compared as plain text
+bool verifyPassword(std::string_view password, std::string_view stored);
+bool isPasswordHash(std::string_view stored);
+
+// Checks password against a fixed hash at the current cost and throws the
+// answer away, for logins with no such account, so the time a login takes
+// doesn't tell whether the email exists
+void verifyNoPassword(std::string_view password);
+
+// Count and latency of every hash computed, for stats
+struct PasswordHashStats {
+	uint64_t count;
+	uint64_t totalMicros;
+	uint64_t maxMicros;
+};
+PasswordHashStats passwordHashStats();
@@ -0,0 +1,108 @@
+#include "Query.h"
+
+static inline int hexValue(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+QueryParams::QueryParams(std::string_view query) : querySize(query.size()) {
+	while (!query.empty()) {
+		size_t amp = query.find('&');
+		std::string_view item = query.substr(0, amp);
+		query.remove_prefix(amp == std::string_view::npos ? query.size() : amp + 1);
+
+		size_t pos = item.find('=');
+		if (pos == std::string_view::npos) continue;
+
+		std::string_view key = decode(item.substr(0, pos));
+		std::string_view value = decode(item.substr(pos + 1));
+
+		// Last one wins, same as it always has
+		bool replaced = false;
+		for (auto &entry : entries) {
+			if (entry.first == key) {
+				entry.second = value;
+				replaced = true;
+				break;
+			}
+		}
+		if (!replaced) entries.emplace_back(key, value);
+	}
+}
+
+std::optional<std::string_view> QueryParams::get(std::string_view key) const {
+	for (auto &entry : entries) {
+		if (entry.first == key) return entry.second;
+	}
+	return std::nullopt;
+}
+
+/*
+ * Returns raw untouched unless it has escapes in it. Decoded text never
+ * comes out longer than it went in, so reserving the whole query up front
+ * means the buffer never reallocates under views already handed out.
+ */
+std::string_view QueryParams::decode(std::string_view raw) {
+	if (raw.find_first_of("%+") == std::string_view::npos) return raw;
+
+	if (decoded.capacity() < querySize) decoded.reserve(querySize);
+
+	size_t start = decoded.size();
+	for (size_t i = 0; i < raw.size(); i++) {
+		char c = raw[i];
+		if (c == '+') {
+			decoded += ' ';
+		} else if (c == '%' && i + 2 < raw.size() && hexValue(raw[i + 1]) >= 0 && hexValue(raw[i + 2]) >= 0) {
+			decoded += (char)(hexValue(raw[i + 1]) * 16 + hexValue(raw[i + 2]));
+			i += 2;
+		} else {
+			decoded += c; // stray '%' is kept as-is
+		}
+	}
+	return std::string_view(decoded.data() + start, decoded.size() - start);
+}
+
+//################################################
+// paging
+
+std::string makeCursor(std::initializer_list<std::string_view> fields) {
+	static const char hex[] = "0123456789abcdef";
+	std::string cursor;
+	bool first = true;
+	for (std::string_view field : fields) {
+		// Fields are split on a zero byte, which SQLite text never contains
+		if (!first) cursor += "00";
+		first = false;
+		for (char c : field) {
+			cursor += hex[(uint8_t)c >> 4];
+			cursor += hex[(uint8_t)c & 0xf];
+		}
+	}
+	return cursor;
+}
+
+bool Page::parse(const QueryParams &params, size_t fields) {
+	if (auto text = params.get("limit")) {
+		size_t value;
+		auto [end, ec] = std::from_chars(text->data(), text->data() + text->size(), value);
+		if (ec != std::errc() || end != text->data() + text->size() || value < 1 || value > MAX_PAGE_SIZE) return(false);
+		limit = value;
+	}
+
+	auto cursor = params.get("after");
+	if (!cursor) return(true);
+	if (cursor->size() % 2) return(false);
+
+	after.assign(1, std::string());
+	for (size_t i = 0; i < cursor->size(); i += 2) {
+		int high = hexValue((*cursor)[i]);
+		int low = hexValue((*cursor)[i + 1]);
+		if (high < 0 || low < 0) return(false);
+		char c = (char)(high << 4 | low);
+		if (c == '\0') after.emplace_back();
+		else after.back() += c;
+	}
+	return after.size() == fields;
+}
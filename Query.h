@@ -0,0 +1,55 @@
+#pragma once
+#include "Util.h"
+#include "Config.h"
+
+/*
+ * Parameters parsed out of a request's query string.
+ *
+ * Keys and values are views into the query string itself; only the ones
+ * containing '%' or '+' get decoded, into a buffer owned by this object.
+ * Either way the views are only valid while both the query string and this
+ * object are alive, which is why it can't be copied or moved.
+ *
+ * Lookups are a linear scan, requests carry a handful of parameters at most.
+ * If a key is repeated the last value wins.
+ */
+class QueryParams {
+	std::vector<std::pair<std::string_view, std::string_view>> entries;
+	std::string decoded;
+	size_t querySize;
+
+public:
+	explicit QueryParams(std::string_view query);
+	QueryParams(const QueryParams&) = delete;
+	QueryParams &operator=(const QueryParams&) = delete;
+
+	size_t count(std::string_view key) const { return get(key) ? 1 : 0; }
+	std::optional<std::string_view> get(std::string_view key) const;
+	// Empty when the key is missing
+	std::string_view operator[](std::string_view key) const { return get(key).value_or(std::string_view()); }
+
+	auto begin() const { return entries.begin(); }
+	auto end() const { return entries.end(); }
+
+private:
+	std::string_view decode(std::string_view raw);
+};
+
+/*
+ * Paging for the actions that return lists. limit caps the rows in one
+ * response, after is the "next" cursor an earlier page handed back. A
+ * cursor holds the sort key of the last row that page returned, and the
+ * next page seeks straight past it on an index rather than counting rows
+ * off with OFFSET, so every page costs the same however deep it is.
+ *
+ * Cursors are opaque to clients: the key fields joined and hex encoded.
+ */
+struct Page {
+	size_t limit = DEFAULT_PAGE_SIZE;
+	std::vector<std::string> after; // empty on the first page
+
+	// False if limit is out of range or after isn't a cursor with this many fields
+	bool parse(const QueryParams &params, size_t fields);
+};
+
+std::string makeCursor(std::initializer_list<std::string_view> fields);
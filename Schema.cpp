@@ -0,0 +1,454 @@
+#include "Schema.h"
+
+//################################################
+// tables
+
+/*
+ * Users:
+ * - id (increases per user)
+ * - name (can be whatever name they want.)
+ * - email (can only happen once in the list)
+ * - password (hashed. cannot be empty)
+ * - payment details, although allow paying in person.
+ */
+static const char *templateUsersTable = R"(
+	CREATE TABLE IF NOT EXISTS Users (
+		id INTEGER PRIMARY KEY AUTOINCREMENT,
+		name TEXT,
+		email TEXT NOT NULL UNIQUE,
+		password TEXT NOT NULL,
+		payment_details TEXT
+	);
+)";
+
+/*
+ * Movies:
+ * - id (must be an int) (increments for each movie)
+ * - name (text of the movie name)
+ * - showtime (unix timestamp possibly?)
+ * - price per ticket (deals, etc)
+ * - rating (g, pg, pg13, etc...)
+ */
+static const char *templateMoviesTable = R"(
+	CREATE TABLE IF NOT EXISTS Movies (
+		id INTEGER PRIMARY KEY AUTOINCREMENT,
+		name TEXT NOT NULL,
+		showtime TEXT NOT NULL,
+		price_per_ticket REAL NOT NULL,
+		rating TEXT CHECK (rating IN ('G', 'PG', 'PG13', 'R', 'NC17')) NOT NULL,
+            theater_id INTEGER NOT NULL,
+            FOREIGN KEY (theater_id) REFERENCES Theaters(id)
+	);
+)";
+
+/*
+ * Tickets
+ * - id (of ticket)
+ * - userid (of person who bought it) (REFERENCES USER TABLE)
+ * - movieid (REFERENCES MOVIE TABLE)
+ * - quantity (of tickets bought)
+ * - purchase time (time of rows creation)
+ */
+static const char *templateTicketsTable = R"(
+	CREATE TABLE IF NOT EXISTS Tickets (
+		id INTEGER PRIMARY KEY AUTOINCREMENT,
+		user_id INTEGER NOT NULL,
+		movie_id INTEGER NOT NULL,
+		quantity INTEGER NOT NULL DEFAULT 1,
+		purchase_time TEXT NOT NULL DEFAULT (datetime('now')),
+		FOREIGN KEY (user_id) REFERENCES Users(id),
+		FOREIGN KEY (movie_id) REFERENCES Movies(id)
+	);
+)";
+
+/*
+ * Admins:
+ * - id (of user that is admin) (REFERENCES USER TABLE)
+ */ 
+static const char *templateAdminsTable = R"(
+	CREATE TABLE IF NOT EXISTS Admins (
+		user_id INTEGER PRIMARY KEY,
+		FOREIGN KEY (user_id) REFERENCES Users(id)
+	);
+)";
+
+/*
+ * Reviews
+ * - id (of the review, added by the "review ids" step)
+ * - userid (of person who left the review) (REFERENCES USER TABLE)
+ * - movieid (the movie the review is for) (REFERENCES MOVIE TABLE)
+ * - review (the users review)
+ */
+static const char *templateReviewTable = R"(
+	CREATE TABLE IF NOT EXISTS Reviews (
+		user_id INTEGER NOT NULL,
+		movie_id INTEGER NOT NULL,
+		review TEXT NOT NULL,
+            PRIMARY KEY (user_id, movie_id),
+		FOREIGN KEY (user_id) REFERENCES Users(id),
+		FOREIGN KEY (movie_id) REFERENCES Movies(id)
+	);
+)";
+
+/*
+ * Theater:
+ * - id (id of the theater)
+     * - name (the name of the theater)
+ */ 
+static const char *templateTheaterTable = R"(
+	CREATE TABLE IF NOT EXISTS Theaters (
+		id INTEGER PRIMARY KEY AUTOINCREMENT,
+            name TEXT NOT NULL
+	);
+)";
+
+/*
+ * Seats (one row per showing, a showing being a row in Movies):
+ * - movie id (REFERENCES MOVIE TABLE)
+ * - capacity (seats in the showing)
+ * - sold (seats taken so far, never more than capacity)
+ */
+static const char *templateSeatsTable = R"(
+	CREATE TABLE IF NOT EXISTS Seats (
+		movie_id INTEGER PRIMARY KEY,
+		capacity INTEGER NOT NULL,
+		sold INTEGER NOT NULL DEFAULT 0 CHECK (sold >= 0 AND sold <= capacity),
+		FOREIGN KEY (movie_id) REFERENCES Movies(id)
+	);
+)";
+
+// Showings from before capacities existed get 100 seats, or however many they already sold
+static const char *backfillSeats = R"(
+	INSERT OR IGNORE INTO Seats (movie_id, capacity, sold)
+		SELECT M.id, MAX(100, IFNULL(SUM(T.quantity), 0)), IFNULL(SUM(T.quantity), 0)
+			FROM Movies M
+				LEFT JOIN Tickets T ON T.movie_id = M.id
+			GROUP BY M.id;
+)";
+
+/*
+ * MovieSales (one row per showing that has sold anything, read by genreport):
+ * - movie id (REFERENCES MOVIE TABLE)
+ * - tickets sold (sum of Tickets.quantity)
+ * - revenue (sum of quantity * price_per_ticket at the time of sale)
+ *
+ * Kept in step with Tickets by the triggers below, inside the same
+ * transaction as the purchase, so the report never has to scan Tickets.
+ */
+static const char *templateMovieSalesTable = R"(
+	CREATE TABLE IF NOT EXISTS MovieSales (
+		movie_id INTEGER PRIMARY KEY,
+		tickets_sold INTEGER NOT NULL DEFAULT 0,
+		revenue REAL NOT NULL DEFAULT 0,
+		FOREIGN KEY (movie_id) REFERENCES Movies(id)
+	);
+)";
+
+static const char *triggerSalesOnTicket = R"(
+	CREATE TRIGGER IF NOT EXISTS sales_on_ticket AFTER INSERT ON Tickets BEGIN
+		INSERT INTO MovieSales (movie_id, tickets_sold, revenue)
+			SELECT NEW.movie_id, NEW.quantity, NEW.quantity * price_per_ticket FROM Movies WHERE id = NEW.movie_id
+			ON CONFLICT (movie_id) DO UPDATE SET
+				tickets_sold = tickets_sold + excluded.tickets_sold,
+				revenue = revenue + excluded.revenue;
+	END;
+)";
+
+static const char *triggerSalesOnMovieDelete = R"(
+	CREATE TRIGGER IF NOT EXISTS sales_on_movie_delete AFTER DELETE ON Movies BEGIN
+		DELETE FROM MovieSales WHERE movie_id = OLD.id;
+	END;
+)";
+
+// Totals for everything sold before the counters existed
+static const char *backfillMovieSales = R"(
+	INSERT OR IGNORE INTO MovieSales (movie_id, tickets_sold, revenue)
+		SELECT M.id, SUM(T.quantity), SUM(T.quantity * M.price_per_ticket)
+			FROM Movies M
+				INNER JOIN Tickets T ON T.movie_id = M.id
+			GROUP BY M.id;
+)";
+
+/*
+ * MovieSearch and ReviewSearch (FTS5 full-text indexes, read by search):
+ * - MovieSearch indexes Movies.name, its rowid is the movie id
+ * - ReviewSearch indexes Reviews.review, its rowid is the review id
+ *
+ * Both are external content tables: the text stays in Movies and Reviews
+ * and only the index lives here. Words are folded to lowercase without
+ * accents, and 2 and 3 letter prefixes get their own index entries so
+ * searching on a partial word doesn't have to scan the term list.
+ *
+ * The triggers keep them in step with every insert, update and delete.
+ * The first ReviewSearch was keyed on Reviews' implicit rowid, which a
+ * VACUUM may renumber; "review ids" below moves it onto Reviews.id.
+ */
+static const char *templateMovieSearchTable = R"(
+	CREATE VIRTUAL TABLE IF NOT EXISTS MovieSearch USING fts5(
+		name,
+		content='Movies', content_rowid='id',
+		tokenize='unicode61 remove_diacritics 2', prefix='2 3'
+	);
+)";
+
+static const char *templateReviewSearchTable = R"(
+	CREATE VIRTUAL TABLE IF NOT EXISTS ReviewSearch USING fts5(
+		review,
+		content='Reviews', content_rowid='rowid',
+		tokenize='unicode61 remove_diacritics 2', prefix='2 3'
+	);
+)";
+
+static const char *triggersMovieSearch = R"(
+	CREATE TRIGGER IF NOT EXISTS movie_search_insert AFTER INSERT ON Movies BEGIN
+		INSERT INTO MovieSearch (rowid, name) VALUES (NEW.id, NEW.name);
+	END;
+	CREATE TRIGGER IF NOT EXISTS movie_search_delete AFTER DELETE ON Movies BEGIN
+		INSERT INTO MovieSearch (MovieSearch, rowid, name) VALUES ('delete', OLD.id, OLD.name);
+	END;
+	CREATE TRIGGER IF NOT EXISTS movie_search_update AFTER UPDATE OF name ON Movies BEGIN
+		INSERT INTO MovieSearch (MovieSearch, rowid, name) VALUES ('delete', OLD.id, OLD.name);
+		INSERT INTO MovieSearch (rowid, name) VALUES (NEW.id, NEW.name);
+	END;
+)";
+
+static const char *triggersReviewSearch = R"(
+	CREATE TRIGGER IF NOT EXISTS review_search_insert AFTER INSERT ON Reviews BEGIN
+		INSERT INTO ReviewSearch (rowid, review) VALUES (NEW.rowid, NEW.review);
+	END;
+	CREATE TRIGGER IF NOT EXISTS review_search_delete AFTER DELETE ON Reviews BEGIN
+		INSERT INTO ReviewSearch (ReviewSearch, rowid, review) VALUES ('delete', OLD.rowid, OLD.review);
+	END;
+	CREATE TRIGGER IF NOT EXISTS review_search_update AFTER UPDATE OF review ON Reviews BEGIN
+		INSERT INTO ReviewSearch (ReviewSearch, rowid, review) VALUES ('delete', OLD.rowid, OLD.review);
+		INSERT INTO ReviewSearch (rowid, review) VALUES (NEW.rowid, NEW.review);
+	END;
+)";
+
+// Index everything already in the tables
+static const char *rebuildSearch = R"(
+	INSERT INTO MovieSearch (MovieSearch) VALUES ('rebuild');
+	INSERT INTO ReviewSearch (ReviewSearch) VALUES ('rebuild');
+)";
+
+/*
+ * Reviews rebuilt with an id of its own, so the ids ReviewSearch holds
+ * survive a VACUUM. A user still reviews a movie at most once. Existing
+ * reviews keep their rowid as their id, then the search index is dropped
+ * and made again on top of the new table.
+ */
+static const char *rebuildReviewsWithId = R"(
+	CREATE TABLE Reviews_new (
+		id INTEGER PRIMARY KEY,
+		user_id INTEGER NOT NULL,
+		movie_id INTEGER NOT NULL,
+		review TEXT NOT NULL,
+		UNIQUE (user_id, movie_id),
+		FOREIGN KEY (user_id) REFERENCES Users(id),
+		FOREIGN KEY (movie_id) REFERENCES Movies(id)
+	);
+	INSERT INTO Reviews_new (id, user_id, movie_id, review)
+		SELECT rowid, user_id, movie_id, review FROM Reviews;
+	DROP TABLE ReviewSearch;
+	DROP TABLE Reviews;
+	ALTER TABLE Reviews_new RENAME TO Reviews;
+)";
+
+static const char *templateReviewSearchById = R"(
+	CREATE VIRTUAL TABLE ReviewSearch USING fts5(
+		review,
+		content='Reviews', content_rowid='id',
+		tokenize='unicode61 remove_diacritics 2', prefix='2 3'
+	);
+)";
+
+static const char *triggersReviewSearchById = R"(
+	CREATE TRIGGER review_search_insert AFTER INSERT ON Reviews BEGIN
+		INSERT INTO ReviewSearch (rowid, review) VALUES (NEW.id, NEW.review);
+	END;
+	CREATE TRIGGER review_search_delete AFTER DELETE ON Reviews BEGIN
+		INSERT INTO ReviewSearch (ReviewSearch, rowid, review) VALUES ('delete', OLD.id, OLD.review);
+	END;
+	CREATE TRIGGER review_search_update AFTER UPDATE OF review ON Reviews BEGIN
+		INSERT INTO ReviewSearch (ReviewSearch, rowid, review) VALUES ('delete', OLD.id, OLD.review);
+		INSERT INTO ReviewSearch (rowid, review) VALUES (NEW.id, NEW.review);
+	END;
+)";
+
+static const char *rebuildReviewSearch = R"(
+	INSERT INTO ReviewSearch (ReviewSearch) VALUES ('rebuild');
+)";
+
+//################################################
+// indexes
+
+/*
+ * Tickets are looked up by user (getticket, optionally narrowed to one
+ * movie) and aggregated by movie (genreport). Both indexes carry the
+ * columns those queries read so the table itself is never touched.
+ */
+static const char *indexTicketsByUser = R"(
+	CREATE INDEX IF NOT EXISTS idx_tickets_user ON Tickets (user_id, movie_id, quantity, purchase_time);
+)";
+static const char *indexTicketsByMovie = R"(
+	CREATE INDEX IF NOT EXISTS idx_tickets_movie ON Tickets (movie_id, quantity);
+)";
+
+/*
+ * Reviews are listed per movie (reviewlist), the (user_id, movie_id) key
+ * leads with user_id so it cannot serve that.
+ */
+static const char *indexReviewsByMovie = R"(
+	CREATE INDEX IF NOT EXISTS idx_reviews_movie ON Reviews (movie_id, user_id, review);
+)";
+
+/*
+ * Movies are joined on theater_id (genreport) and filtered by name prefix
+ * and showtime (listmovies). LIKE is case-insensitive, so the name index
+ * has to be NOCASE for SQLite to use it for prefix matches.
+ */
+static const char *indexMoviesByTheater = R"(
+	CREATE INDEX IF NOT EXISTS idx_movies_theater ON Movies (theater_id);
+)";
+static const char *indexMoviesByName = R"(
+	CREATE INDEX IF NOT EXISTS idx_movies_name ON Movies (name COLLATE NOCASE);
+)";
+static const char *indexMoviesByShowtime = R"(
+	CREATE INDEX IF NOT EXISTS idx_movies_showtime ON Movies (showtime);
+)";
+
+/*
+ * MovieSales is read highest revenue first, ties broken by movie id
+ * (genreport), so a page seeks straight to its cursor.
+ */
+static const char *indexMovieSalesByRevenue = R"(
+	CREATE INDEX IF NOT EXISTS idx_movie_sales_revenue ON MovieSales (revenue DESC, movie_id);
+)";
+
+/*
+ * Ticket lists are paged in id order (getticket), seeking past the last id
+ * of the previous page. These replace idx_tickets_user, whose order after
+ * movie_id was by quantity and so couldn't serve that seek.
+ */
+static const char *dropTicketsByUser = R"(
+	DROP INDEX IF EXISTS idx_tickets_user;
+)";
+static const char *indexTicketsByUserId = R"(
+	CREATE INDEX IF NOT EXISTS idx_tickets_user_id ON Tickets (user_id, id);
+)";
+static const char *indexTicketsByUserMovie = R"(
+	CREATE INDEX IF NOT EXISTS idx_tickets_user_movie ON Tickets (user_id, movie_id, id);
+)";
+
+//################################################
+// migrations
+
+/*
+ * Ordered schema steps. PRAGMA user_version holds how many of these a
+ * database has had applied, and startup runs whatever is left. Once a step
+ * has shipped it must not change, put new work in a new step at the end.
+ */
+static const std::vector<Migration> migrations = {
+	{"create tables", {
+		templateUsersTable,
+		templateMoviesTable,
+		templateTicketsTable,
+		templateReviewTable,
+		templateTheaterTable,
+		templateAdminsTable,
+	}},
+	{"secondary indexes", {
+		indexTicketsByUser,
+		indexTicketsByMovie,
+		indexReviewsByMovie,
+		indexMoviesByTheater,
+		indexMoviesByName,
+		indexMoviesByShowtime,
+	}},
+	{"seat capacity", {
+		templateSeatsTable,
+		backfillSeats,
+	}},
+	{"sales aggregates", {
+		templateMovieSalesTable,
+		backfillMovieSales,
+		triggerSalesOnTicket,
+		triggerSalesOnMovieDelete,
+	}},
+	{"paging indexes", {
+		dropTicketsByUser,
+		indexTicketsByUserId,
+		indexTicketsByUserMovie,
+	}},
+	{"full-text search", {
+		templateMovieSearchTable,
+		templateReviewSearchTable,
+		triggersMovieSearch,
+		triggersReviewSearch,
+		rebuildSearch,
+	}},
+	{"report index", {
+		indexMovieSalesByRevenue,
+	}},
+	{"review ids", {
+		rebuildReviewsWithId,
+		indexReviewsByMovie,
+		templateReviewSearchById,
+		triggersReviewSearchById,
+		rebuildReviewSearch,
+	}},
+};
+
+static bool migrationExec(sqlite3 *db, const char *sql) {
+	char *errMsg = nullptr;
+	if (sqlite3_exec(db, sql, nullptr, nullptr, &errMsg) != SQLITE_OK) {
+		std::cerr << "Migration error: " << errMsg << "\n";
+		sqlite3_free(errMsg);
+		return(false);
+	}
+	return(true);
+}
+
+static int schemaVersion(sqlite3 *db) {
+	sqlite3_stmt *stmt = nullptr;
+	int version = -1;
+	if (sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, nullptr) == SQLITE_OK &&
+		sqlite3_step(stmt) == SQLITE_ROW) {
+		version = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+	return version;
+}
+
+bool runMigrations(sqlite3 *db) {
+	int version = schemaVersion(db);
+	if (version < 0) {
+		std::cerr << "Can't read schema version: " << sqlite3_errmsg(db) << "\n";
+		return(false);
+	}
+	if (version > (int)migrations.size()) {
+		std::cerr << "Database schema version " << version << " is newer than this build knows about\n";
+		return(false);
+	}
+
+	// Each step and its version bump commit together, a failed step leaves the database as it was
+	for (int step = version; step < (int)migrations.size(); step++) {
+		const Migration &migration = migrations[step];
+		std::cout << "Applying migration " << step + 1 << ": " << migration.description << "\n";
+
+		if (!migrationExec(db, "BEGIN IMMEDIATE;")) return(false);
+
+		bool ok = true;
+		for (const char *sql : migration.sql) {
+			if (!(ok = migrationExec(db, sql))) break;
+		}
+		if (ok) ok = migrationExec(db, ("PRAGMA user_version = " + std::to_string(step + 1) + ";").c_str());
+
+		if (!ok) {
+			migrationExec(db, "ROLLBACK;");
+			return(false);
+		}
+		if (!migrationExec(db, "COMMIT;")) return(false);
+	}
+	return(true);
+}
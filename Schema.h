@@ -0,0 +1,13 @@
+#pragma once
+#include "Util.h"
+
+/*
+ * One step of schema history: a list of statements run in a single
+ * transaction.
+ */
+struct Migration {
+	const char *description;
+	std::vector<const char*> sql;
+};
+
+bool runMigrations(sqlite3 *db);
@@ -0,0 +1,66 @@
+#include "Seats.h"
+
+SeatLedger seats;
+
+bool SeatLedger::load(Connection &conn) {
+	std::unordered_map<int64_t, int64_t> loaded;
+
+	Statement stmt(conn, Stmt::LoadSeats);
+	if (!stmt) return(false);
+
+	int rc;
+	while ((rc = stmt.step()) == SQLITE_ROW) {
+		loaded[sqlite3_column_int64(stmt, 0)] = sqlite3_column_int64(stmt, 1);
+	}
+	if (rc != SQLITE_DONE) return(false);
+
+	std::unique_lock<std::shared_mutex> guard(lock);
+	showings.swap(loaded);
+	return(true);
+}
+
+SeatLedger::Result SeatLedger::reserve(int64_t movie_id, int64_t count) {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	auto it = showings.find(movie_id);
+	if (it == showings.end()) return Result::NoShowing;
+	if (it->second < count) return Result::SoldOut;
+	it->second -= count;
+	return Result::Reserved;
+}
+
+void SeatLedger::release(int64_t movie_id, int64_t count) {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	auto it = showings.find(movie_id);
+	if (it != showings.end()) it->second += count;
+}
+
+bool SeatLedger::resync(Connection &conn, int64_t movie_id) {
+	Statement stmt(conn, Stmt::LoadSeat);
+	if (!stmt) return(false);
+	sqlite3_bind_int64(stmt, 1, movie_id);
+
+	int rc = stmt.step();
+	if (rc != SQLITE_ROW && rc != SQLITE_DONE) return(false);
+
+	std::unique_lock<std::shared_mutex> guard(lock);
+	if (rc == SQLITE_ROW) showings[movie_id] = sqlite3_column_int64(stmt, 0);
+	else showings.erase(movie_id);
+	return(true);
+}
+
+void SeatLedger::add(int64_t movie_id, int64_t capacity) {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	showings[movie_id] = capacity;
+}
+
+void SeatLedger::remove(int64_t movie_id) {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	showings.erase(movie_id);
+}
+
+std::optional<int64_t> SeatLedger::remaining(int64_t movie_id) {
+	std::shared_lock<std::shared_mutex> guard(lock);
+	auto it = showings.find(movie_id);
+	if (it == showings.end()) return std::nullopt;
+	return it->second;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "Util.h"
+#include "Database.h"
+
+/*
+ * Seats left in every showing, mirrored from the Seats table so a purchase
+ * for a sold-out showing is turned away without going to the database.
+ *
+ * Purchases and showings coming and going are all writes, so the counts
+ * are only ever changed from the write pipeline's thread, one purchase at
+ * a time; getmovie reads them from other threads. A plain map under a
+ * reader/writer lock is all that takes.
+ *
+ * The table is still the authority: the purchase transaction re-checks
+ * capacity in SQL. A reservation that doesn't get committed is handed
+ * back with release(), and if the table turned down seats the ledger
+ * thought were free, resync() reads the showing back from the table.
+ */
+class SeatLedger {
+public:
+	enum class Result { Reserved, NoShowing, SoldOut };
+
+	bool load(Connection &conn);
+	Result reserve(int64_t movie_id, int64_t count);
+	void release(int64_t movie_id, int64_t count);
+	// Drops the showing if the table no longer has it
+	bool resync(Connection &conn, int64_t movie_id);
+
+	// Kept in step with addmovie and delmovie
+	void add(int64_t movie_id, int64_t capacity);
+	void remove(int64_t movie_id);
+
+	// Empty if there is no such showing
+	std::optional<int64_t> remaining(int64_t movie_id);
+
+private:
+	std::shared_mutex lock;
+	std::unordered_map<int64_t, int64_t> showings; // movie id, seats left
+};
+
+extern SeatLedger seats;
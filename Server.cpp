@@ -0,0 +1,114 @@
+#include "Server.h"
+#include "MbsBackend.h"
+#include "Config.h"
+
+//################################################
+// sessions
+
+Session::Session(tcp::socket &&socket) : stream(std::move(socket)) {}
+
+void Session::run() {
+	// Start on the session's strand so nothing here runs concurrently
+	asio::dispatch(stream.get_executor(), beast::bind_front_handler(&Session::doRead, shared_from_this()));
+}
+
+void Session::doRead() {
+	req = {};
+	// Drop connections that sit idle between requests
+	stream.expires_after(std::chrono::seconds(config.idle_timeout));
+
+	// When tracing, wait for the request's first bytes before starting the
+	// clock, so the read stage doesn't include the time the connection sat idle
+	if (tracer.enabled() && buffer.size() == 0) {
+		stream.async_read_some(buffer.prepare(4096), beast::bind_front_handler(&Session::onFirstBytes, shared_from_this()));
+		return;
+	}
+
+	tracer.start(trace);
+	trace.begin(Stage::Read);
+	// Any pipelined requests are already sitting in the buffer and get
+	// parsed from there in order, one per read.
+	http::async_read(stream, buffer, req, beast::bind_front_handler(&Session::onRead, shared_from_this()));
+}
+
+void Session::onFirstBytes(beast::error_code ec, std::size_t bytes) {
+	if (ec == asio::error::eof || ec == beast::error::timeout) return doClose();
+	if (ec) {
+		DBG_PRINT("read failed\n");
+		return;
+	}
+
+	buffer.commit(bytes);
+	tracer.start(trace);
+	trace.begin(Stage::Read);
+	http::async_read(stream, buffer, req, beast::bind_front_handler(&Session::onRead, shared_from_this()));
+}
+
+void Session::onRead(beast::error_code ec, std::size_t bytes) {
+	boost::ignore_unused(bytes);
+
+	if (ec == http::error::end_of_stream || ec == beast::error::timeout) return doClose();
+	if (ec) {
+		DBG_PRINT("read failed\n");
+		return;
+	}
+	trace.end(Stage::Read);
+
+	res = {};
+	handleRequest(req, res, [self = shared_from_this()] {
+		asio::dispatch(self->stream.get_executor(), beast::bind_front_handler(&Session::doWrite, self));
+	}, &trace);
+}
+
+void Session::doWrite() {
+	trace.begin(Stage::Write);
+	http::async_write(stream, res, beast::bind_front_handler(&Session::onWrite, shared_from_this()));
+}
+
+void Session::onWrite(beast::error_code ec, std::size_t bytes) {
+	boost::ignore_unused(bytes);
+
+	if (ec) {
+		DBG_PRINT("write failed\n");
+		return;
+	}
+	trace.end(Stage::Write);
+	tracer.finish(trace);
+
+	// Keep reading from the same socket unless either side asked to close
+	if (res.need_eof()) return doClose();
+	doRead();
+}
+
+void Session::doClose() {
+	beast::error_code ec;
+	stream.socket().shutdown(tcp::socket::shutdown_send, ec);
+}
+
+//################################################
+// listener
+
+Listener::Listener(asio::io_context &ioc, tcp::endpoint endpoint) : ioc(ioc), acceptor(asio::make_strand(ioc)) {
+	acceptor.open(endpoint.protocol());
+	acceptor.set_option(asio::socket_base::reuse_address(true));
+	acceptor.bind(endpoint);
+	acceptor.listen(asio::socket_base::max_listen_connections);
+}
+
+void Listener::run() {
+	doAccept();
+}
+
+void Listener::doAccept() {
+	// Each connection gets its own strand
+	acceptor.async_accept(asio::make_strand(ioc), beast::bind_front_handler(&Listener::onAccept, shared_from_this()));
+}
+
+void Listener::onAccept(beast::error_code ec, tcp::socket socket) {
+	if (ec) {
+		std::cerr << "Accept error: " << ec.message() << "\n";
+	} else {
+		std::make_shared<Session>(std::move(socket))->run();
+	}
+	doAccept();
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "Util.h"
+#include "Trace.h"
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+
+/*
+ * One accepted connection. Reads a request, runs it through handleRequest()
+ * and writes the response, all asynchronously on the connection's strand.
+ * handleRequest() may finish on another thread; the write is always
+ * dispatched back onto the strand.
+ * The connection is kept open for further requests until the client closes
+ * it, asks for "Connection: close", or stays idle past the idle timeout.
+ */
+class Session : public std::enable_shared_from_this<Session> {
+	beast::tcp_stream stream;
+	beast::flat_buffer buffer;
+	http::request<http::string_body> req;
+	http::response<http::string_body> res;
+	RequestTrace trace;
+
+public:
+	explicit Session(tcp::socket &&socket);
+	void run();
+
+private:
+	void doRead();
+	void onFirstBytes(beast::error_code ec, std::size_t bytes);
+	void onRead(beast::error_code ec, std::size_t bytes);
+	void doWrite();
+	void onWrite(beast::error_code ec, std::size_t bytes);
+	void doClose();
+};
+
+/*
+ * Accepts incoming connections and hands each one off to its own Session.
+ * Every session gets a strand so the io_context can be run from many threads.
+ */
+class Listener : public std::enable_shared_from_this<Listener> {
+	asio::io_context &ioc;
+	tcp::acceptor acceptor;
+
+public:
+	Listener(asio::io_context &ioc, tcp::endpoint endpoint);
+	void run();
+
+private:
+	void doAccept();
+	void onAccept(beast::error_code ec, tcp::socket socket);
+};
@@ -0,0 +1,145 @@
+#include "Session.h"
+#include "Config.h"
+#include <openssl/rand.h>
+
+SessionStore sessions;
+AdminSet admins;
+
+// How many sessions a shard adds between sweeps for expired ones
+static constexpr unsigned int sweepInterval = 256;
+
+static inline int hexValue(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+bool SessionStore::parse(std::string_view text, Token &token) {
+	if (text.size() != token.size() * 2) return(false);
+	for (size_t i = 0; i < token.size(); i++) {
+		int high = hexValue(text[i * 2]);
+		int low = hexValue(text[i * 2 + 1]);
+		if (high < 0 || low < 0) return(false);
+		token[i] = (uint8_t)(high << 4 | low);
+	}
+	return(true);
+}
+
+SessionStore::SessionMap::iterator SessionStore::Shard::erase(SessionMap::iterator it) {
+	auto user = byUser.find(it->second.user_id);
+	if (user != byUser.end()) {
+		std::vector<Token> &tokens = user->second;
+		tokens.erase(std::remove(tokens.begin(), tokens.end(), it->first), tokens.end());
+		if (tokens.empty()) byUser.erase(user);
+	}
+	return sessions.erase(it);
+}
+
+std::string SessionStore::issue(int64_t user_id) {
+	static const char hex[] = "0123456789abcdef";
+	static_assert((shardCount & (shardCount - 1)) == 0, "shard bits are masked into the token");
+
+	Token token;
+	if (RAND_bytes(token.data(), (int)token.size()) != 1) return std::string();
+	token[15] = (uint8_t)((token[15] & ~(shardCount - 1)) | ((uint64_t)user_id % shardCount));
+
+	Clock::time_point now = Clock::now();
+	Shard &shard = shardFor(token);
+	{
+		std::lock_guard<std::mutex> guard(shard.lock);
+		if (++shard.issued % sweepInterval == 0) {
+			for (auto it = shard.sessions.begin(); it != shard.sessions.end();) {
+				if (it->second.expires <= now) it = shard.erase(it);
+				else ++it;
+			}
+		}
+		auto [it, added] = shard.sessions.try_emplace(token, Session{user_id, now + std::chrono::seconds(config.session_ttl)});
+		if (!added) return std::string();
+		shard.byUser[user_id].push_back(token);
+	}
+
+	std::string text;
+	text.reserve(token.size() * 2);
+	for (uint8_t byte : token) {
+		text += hex[byte >> 4];
+		text += hex[byte & 0xf];
+	}
+	return text;
+}
+
+std::optional<int64_t> SessionStore::find(std::string_view text) {
+	Token token;
+	if (!parse(text, token)) return std::nullopt;
+
+	Shard &shard = shardFor(token);
+	std::lock_guard<std::mutex> guard(shard.lock);
+	auto it = shard.sessions.find(token);
+	if (it == shard.sessions.end()) return std::nullopt;
+	if (it->second.expires <= Clock::now()) {
+		shard.erase(it);
+		return std::nullopt;
+	}
+	return it->second.user_id;
+}
+
+void SessionStore::revoke(std::string_view text) {
+	Token token;
+	if (!parse(text, token)) return;
+
+	Shard &shard = shardFor(token);
+	std::lock_guard<std::mutex> guard(shard.lock);
+	auto it = shard.sessions.find(token);
+	if (it != shard.sessions.end()) shard.erase(it);
+}
+
+void SessionStore::revokeUser(int64_t user_id) {
+	Shard &shard = shards[(uint64_t)user_id % shardCount];
+	std::lock_guard<std::mutex> guard(shard.lock);
+	auto user = shard.byUser.find(user_id);
+	if (user == shard.byUser.end()) return;
+	for (const Token &token : user->second) shard.sessions.erase(token);
+	shard.byUser.erase(user);
+}
+
+size_t SessionStore::size() {
+	size_t total = 0;
+	for (Shard &shard : shards) {
+		std::lock_guard<std::mutex> guard(shard.lock);
+		total += shard.sessions.size();
+	}
+	return total;
+}
+
+//################################################
+// admins
+
+bool AdminSet::load(Connection &conn) {
+	std::unordered_set<int64_t> loaded;
+
+	Statement stmt(conn, Stmt::LoadAdmins);
+	if (!stmt) return(false);
+
+	int rc;
+	while ((rc = stmt.step()) == SQLITE_ROW) loaded.insert(sqlite3_column_int64(stmt, 0));
+	if (rc != SQLITE_DONE) return(false);
+
+	std::unique_lock<std::shared_mutex> guard(lock);
+	ids.swap(loaded);
+	return(true);
+}
+
+bool AdminSet::contains(int64_t user_id) {
+	std::shared_lock<std::shared_mutex> guard(lock);
+	return ids.count(user_id) != 0;
+}
+
+void AdminSet::insert(int64_t user_id) {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	ids.insert(user_id);
+}
+
+void AdminSet::erase(int64_t user_id) {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	ids.erase(user_id);
+}
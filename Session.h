@@ -0,0 +1,100 @@
+#pragma once
+#include "Util.h"
+#include "Database.h"
+
+/*
+ * Who a request is acting for, once its token or credentials have been
+ * checked. Handlers that don't need a login get an empty one.
+ */
+struct Caller {
+	int64_t user_id = 0;
+	bool admin = false;
+	// createacc only: the new password, hashed before the insert is queued
+	std::string passwordHash;
+};
+
+/*
+ * Logged-in sessions, keyed by the token verifyacc hands out.
+ *
+ * Tokens are 16 random bytes sent as 32 hex characters. The store is split
+ * into shards so threads looking up different sessions rarely wait on the
+ * same lock, and a lookup is one hash probe with no database round trip.
+ * A user's sessions all live in one shard, picked by user id, which the
+ * token's last byte points at. Each shard also indexes its sessions by
+ * user, so ending a user's sessions only touches that user's tokens.
+ *
+ * Only the user id is kept. Whether they are an admin is looked up in
+ * admins on every request, so a role change applies to live sessions at
+ * once and there is no second copy of it to keep in step.
+ *
+ * Sessions expire config.session_ttl seconds after they were issued. Expired
+ * ones are dropped when looked up, and each shard is swept now and then as
+ * new sessions are added.
+ */
+class SessionStore {
+public:
+	using Token = std::array<uint8_t, 16>;
+
+	// Empty if no random bytes could be had
+	std::string issue(int64_t user_id);
+	// The user the token belongs to
+	std::optional<int64_t> find(std::string_view token);
+	void revoke(std::string_view token);
+
+	// For when an account is deleted
+	void revokeUser(int64_t user_id);
+
+	size_t size();
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Session {
+		int64_t user_id;
+		Clock::time_point expires;
+	};
+	struct TokenHash {
+		size_t operator()(const Token &token) const {
+			size_t hash;
+			std::memcpy(&hash, token.data(), sizeof(hash));
+			return hash;
+		}
+	};
+	using SessionMap = std::unordered_map<Token, Session, TokenHash>;
+	// Own cache line each, so shards don't slow each other down
+	struct alignas(64) Shard {
+		std::mutex lock;
+		SessionMap sessions;
+		std::unordered_map<int64_t, std::vector<Token>> byUser;
+		unsigned int issued = 0;
+
+		// Drops a session from both maps, the lock must be held
+		SessionMap::iterator erase(SessionMap::iterator it);
+	};
+
+	static constexpr size_t shardCount = 16;
+	Shard shards[shardCount];
+
+	// The low bits of the last byte hold the shard, the map's hash doesn't use them
+	Shard &shardFor(const Token &token) { return shards[token[15] % shardCount]; }
+	static bool parse(std::string_view text, Token &token);
+};
+
+/*
+ * User ids in the Admins table, so checking a role is a set lookup rather
+ * than a query. Loaded at startup and kept in step by whatever changes
+ * the table.
+ */
+class AdminSet {
+	std::shared_mutex lock;
+	std::unordered_set<int64_t> ids;
+
+public:
+	bool load(Connection &conn);
+	bool contains(int64_t user_id);
+	void insert(int64_t user_id);
+	void erase(int64_t user_id);
+};
+
+extern SessionStore sessions;
+extern AdminSet admins;
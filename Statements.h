@@ -0,0 +1,156 @@
+#pragma once
+
+/*
+ * Every statement the handlers run. Each connection keeps one compiled copy
+ * of each of these around (see Statement in Database.h), so the SQL for a
+ * request is only ever parsed once per connection.
+ *
+ * Add the enum entry and its SQL in the same position in both lists.
+ */
+enum class Stmt : int {
+	InsertUser,
+	UpdatePayment,
+	DeleteUser,
+	Authenticate,
+	VerifyPayment,
+	InsertTicket,
+	SelectTickets,
+	SelectTicketsForMovie,
+	InsertAdmin,
+	DeleteAdmin,
+	InsertMovie,
+	DeleteMovie,
+	SelectUser,
+	SelectAdminUser,
+	SelectUserId,
+	InsertReview,
+	SelectReviews,
+	InsertTheater,
+	DeleteTheater,
+	Report,
+	ReportByTheater,
+	LoadMovies,
+	LoadTheaters,
+	LoadAdmins,
+	UpdatePassword,
+	Begin,
+	Commit,
+	Rollback,
+	Savepoint,
+	ReleaseSavepoint,
+	RollbackToSavepoint,
+	InsertSeats,
+	DeleteSeats,
+	TakeSeats,
+	LoadSeats,
+	SearchMovies,
+	SearchReviews,
+	LoadSeat,
+	Count
+};
+
+inline constexpr const char *statementSql[] = {
+	// InsertUser
+	"INSERT INTO Users (name, email, password, payment_details) VALUES (?, ?, ?, ?);",
+	// UpdatePayment
+	"UPDATE Users SET payment_details = ? WHERE id = ?",
+	// DeleteUser
+	"DELETE FROM Users WHERE id = ?",
+	// Authenticate (the one place passwords are read, checked by verifyPassword)
+	"SELECT id, password FROM Users WHERE email = ?",
+	// VerifyPayment
+	"SELECT payment_details FROM Users WHERE id = ?",
+	// InsertTicket
+	"INSERT INTO Tickets(user_id, movie_id, quantity, purchase_time) VALUES (?,?,?,?)",
+	// SelectTickets (a page: user, after ticket id, limit)
+	"SELECT * FROM Tickets WHERE user_id = ?1 AND id > ?2 ORDER BY id LIMIT ?3",
+	// SelectTicketsForMovie (a page: user, after ticket id, limit, movie)
+	"SELECT * FROM Tickets WHERE user_id = ?1 AND movie_id = ?4 AND id > ?2 ORDER BY id LIMIT ?3",
+	// InsertAdmin
+	"INSERT INTO Admins (user_id) VALUES (?)",
+	// DeleteAdmin
+	"DELETE FROM Admins WHERE user_id = ?",
+	// InsertMovie
+	"INSERT INTO Movies(name,showtime,price_per_ticket,rating,theater_id) VALUES (?,?,?,?,?)",
+	// DeleteMovie
+	"DELETE FROM Movies WHERE id = ?",
+	// SelectUser (never the password, accdetails sends every column back)
+	"SELECT id, name, email, payment_details FROM Users WHERE id = ?",
+	// SelectAdminUser (same)
+	"SELECT U.id, U.name, U.email, U.payment_details, CASE WHEN U.id = A.user_id THEN 1 WHEN U.id <> A.user_id THEN 0 END AS is_admin FROM Users U INNER JOIN Admins A ON A.user_id = U.id WHERE U.id = ?",
+	// SelectUserId
+	"SELECT id FROM Users WHERE email = ?",
+	// InsertReview
+	"INSERT INTO Reviews(user_id, movie_id, review) VALUES (?, ?, ?)",
+	// SelectReviews (a page: movie, after user id, limit)
+	"SELECT user_id, review FROM Reviews WHERE movie_id = ?1 AND user_id > ?2 ORDER BY user_id LIMIT ?3",
+	// InsertTheater
+	"INSERT INTO Theaters(name) VALUES (?)",
+	// DeleteTheater
+	"DELETE FROM Theaters WHERE id = ?",
+	// Report (reads the MovieSales counters, one row per showing, never Tickets)
+	// A page: after revenue (+Inf for the first), after movie id, limit.
+	// Walks idx_movie_sales_revenue in order, so no page sorts or groups.
+	R"(
+		SELECT S.movie_id, M.name, S.tickets_sold, S.revenue AS 'total_revenue'
+			FROM MovieSales S
+				INNER JOIN Movies M ON M.id = S.movie_id
+				INNER JOIN Theaters H ON H.id = M.theater_id
+			WHERE S.revenue <= ?1 AND (S.revenue < ?1 OR S.movie_id > ?2)
+			ORDER BY S.revenue DESC, S.movie_id
+			LIMIT ?3;
+	)",
+	// ReportByTheater (same, theater is ?4; sorts just that theater's showings)
+	R"(
+		SELECT S.movie_id, H.name AS 'theater', M.name, S.tickets_sold, S.revenue AS 'total_revenue'
+			FROM MovieSales S
+				INNER JOIN Movies M ON M.id = S.movie_id
+				INNER JOIN Theaters H ON H.id = M.theater_id
+			WHERE S.revenue <= ?1 AND (S.revenue < ?1 OR S.movie_id > ?2) AND M.theater_id = ?4
+			ORDER BY S.revenue DESC, S.movie_id
+			LIMIT ?3;
+	)",
+	// LoadMovies (same columns as SELECT *, listmovies returns them as-is)
+	"SELECT id, name, showtime, price_per_ticket, rating, theater_id FROM Movies ORDER BY id",
+	// LoadTheaters
+	"SELECT id, name FROM Theaters ORDER BY id",
+	// LoadAdmins
+	"SELECT user_id FROM Admins",
+	// UpdatePassword
+	"UPDATE Users SET password = ? WHERE id = ?",
+	// Begin (IMMEDIATE takes the write lock up front instead of upgrading halfway through)
+	"BEGIN IMMEDIATE",
+	// Commit
+	"COMMIT",
+	// Rollback
+	"ROLLBACK",
+	// Savepoint (a Transaction opened inside another one, e.g. inside a write batch)
+	"SAVEPOINT nested",
+	// ReleaseSavepoint
+	"RELEASE nested",
+	// RollbackToSavepoint (leaves the savepoint open, release it afterwards)
+	"ROLLBACK TO nested",
+	// InsertSeats
+	"INSERT INTO Seats (movie_id, capacity) VALUES (?, ?)",
+	// DeleteSeats
+	"DELETE FROM Seats WHERE movie_id = ?",
+	// TakeSeats (changes nothing if there aren't enough left)
+	"UPDATE Seats SET sold = sold + ?1 WHERE movie_id = ?2 AND sold + ?1 <= capacity",
+	// LoadSeats
+	"SELECT movie_id, capacity - sold FROM Seats",
+	// SearchMovies (an FTS5 query, limit; best match first)
+	"SELECT rowid FROM MovieSearch WHERE MovieSearch MATCH ?1 ORDER BY rank LIMIT ?2",
+	// SearchReviews (same)
+	R"(
+		SELECT R.movie_id, R.user_id, R.review
+			FROM ReviewSearch S
+				INNER JOIN Reviews R ON R.id = S.rowid
+			WHERE ReviewSearch MATCH ?1
+			ORDER BY S.rank
+			LIMIT ?2;
+	)",
+	// LoadSeat (one showing)
+	"SELECT capacity - sold FROM Seats WHERE movie_id = ?",
+};
+
+static_assert(sizeof(statementSql) / sizeof(statementSql[0]) == (int)Stmt::Count, "every Stmt needs its SQL");
@@ -0,0 +1,106 @@
+#include "Trace.h"
+#include "Config.h"
+
+Tracer tracer;
+thread_local RequestTrace *handlerTrace = nullptr;
+
+static const char *const stageNames[] = {
+	"read", "parse", "hash queue", "auth", "hash", "write queue", "handler", "payment", "sql", "commit", "respond", "write",
+};
+static_assert(sizeof(stageNames) / sizeof(stageNames[0]) == (size_t)Stage::Count, "a name for every stage");
+
+uint32_t RequestTrace::threadNumber() {
+	static std::atomic<uint32_t> threads{0};
+	thread_local uint32_t number = threads.fetch_add(1, std::memory_order_relaxed) + 1;
+	return number;
+}
+
+bool Tracer::enabled() const {
+	return config.trace_rate > 0 || config.trace_slow > 0;
+}
+
+void Tracer::start(RequestTrace &trace) {
+	trace = {};
+	if (!enabled()) return;
+
+	thread_local std::minstd_rand rng(std::random_device{}());
+	trace.sampled = config.trace_rate >= 1 ||
+		(config.trace_rate > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < config.trace_rate);
+	trace.active = trace.sampled || config.trace_slow > 0;
+}
+
+void Tracer::finish(const RequestTrace &trace) {
+	if (!trace.active || !config.trace_buffer) return;
+
+	const RequestTrace::Span &first = trace.spans[(int)Stage::Read], &last = trace.spans[(int)Stage::Write];
+	bool slow = config.trace_slow && last.end >= first.begin && last.end - first.begin >= config.trace_slow * 1000ull;
+	if (!trace.sampled && !slow) return;
+
+	Ring &ring = mine();
+	std::lock_guard<std::mutex> guard(ring.lock);
+	if (ring.requests.size() < config.trace_buffer) {
+		ring.requests.push_back(trace);
+	} else {
+		ring.requests[ring.next] = trace;
+		ring.next = (ring.next + 1) % ring.requests.size();
+	}
+}
+
+Tracer::Ring &Tracer::mine() {
+	thread_local Ring *ring = nullptr;
+	if (!ring) {
+		auto made = std::make_unique<Ring>();
+		ring = made.get();
+		std::lock_guard<std::mutex> guard(lock);
+		rings.push_back(std::move(made));
+	}
+	return *ring;
+}
+
+//################################################
+// trace event format
+
+/*
+ * One complete ("X") event per stage that ran, and one for the whole
+ * request around them, on the thread each ran on. Times are µs from the
+ * earliest request kept, so the numbers stay readable.
+ */
+void Tracer::render(JsonWriter &json) {
+	std::vector<RequestTrace> requests;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (auto &ring : rings) {
+			std::lock_guard<std::mutex> ringGuard(ring->lock);
+			requests.insert(requests.end(), ring->requests.begin(), ring->requests.end());
+		}
+	}
+	std::sort(requests.begin(), requests.end(), [](const RequestTrace &a, const RequestTrace &b) {
+		return a.spans[(int)Stage::Read].begin < b.spans[(int)Stage::Read].begin;
+	});
+	uint64_t origin = requests.empty() ? 0 : requests.front().spans[(int)Stage::Read].begin;
+
+	auto event = [&json, origin](std::string_view name, std::string_view action, const RequestTrace::Span &span) {
+		json.beginObject()
+			.field("name", name)
+			.field("cat", action)
+			.field("ph", "X")
+			.field("ts", (span.begin - origin) / 1000.0)
+			.field("dur", (span.end - span.begin) / 1000.0)
+			.field("pid", 1)
+			.field("tid", (uint64_t)span.thread)
+			.endObject();
+	};
+
+	json.beginArray();
+	for (const RequestTrace &request : requests) {
+		const RequestTrace::Span &read = request.spans[(int)Stage::Read], &write = request.spans[(int)Stage::Write];
+		RequestTrace::Span whole{read.begin, write.end, read.thread};
+		event(request.action, request.action, whole);
+
+		for (int stage = 0; stage < (int)Stage::Count; stage++) {
+			const RequestTrace::Span &span = request.spans[stage];
+			if (span.begin && span.end >= span.begin) event(stageNames[stage], request.action, span);
+		}
+	}
+	json.endArray();
+}
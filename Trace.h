@@ -0,0 +1,111 @@
+#pragma once
+#include "Util.h"
+#include "Json.h"
+
+/*
+ * Stages a request passes through, in the order they happen. Payment and
+ * Sql are inside Handler, for the actions that mark them.
+ */
+enum class Stage : uint8_t {
+	Read,       // first bytes of the request to the whole request parsed
+	Parse,      // query string, action lookup and required fields
+	HashQueue,  // waiting for a password hashing thread
+	Auth,       // token or email/password check
+	Hash,       // hashing a new account's password
+	WriteQueue, // waiting for the write pipeline to start the action
+	Handler,    // the action itself
+	Payment,    // verifyPayment()
+	Sql,        // the statements that record a purchase
+	Commit,     // a write waiting for its batch to commit and its reply to reach an io thread
+	Respond,    // compressing and preparing the response
+	Write,      // sending the response
+	Count
+};
+
+/*
+ * When each stage of one request began and ended, and on which thread.
+ * A Session keeps one and reuses it for every request on the connection.
+ *
+ * Nothing is recorded unless the request is active, so a request that
+ * isn't being traced costs one branch per stage. The stages are stamped by
+ * whichever thread runs them, one after another, never two at once.
+ */
+struct RequestTrace {
+	struct Span {
+		uint64_t begin = 0; // ns on the steady clock, 0 if the stage never ran
+		uint64_t end = 0;
+		uint32_t thread = 0;
+	};
+
+	bool active = false;
+	bool sampled = false;
+	std::string_view action = "unknown";
+	Span spans[(int)Stage::Count];
+
+	void begin(Stage stage) { if (active) { spans[(int)stage].begin = now(); spans[(int)stage].thread = threadNumber(); } }
+	void end(Stage stage) { if (active) spans[(int)stage].end = now(); }
+	void label(std::string_view name) { if (active) action = name; }
+
+	static uint64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	// Small number for the calling thread, used as its id in the trace
+	static uint32_t threadNumber();
+};
+
+/*
+ * The trace of the request a handler is running for on this thread, set by
+ * runAction() around the handler call. Stays empty outside a handler.
+ */
+extern thread_local RequestTrace *handlerTrace;
+
+// Marks a stage inside a handler for as long as it is in scope
+class TraceSpan {
+	RequestTrace *trace;
+	Stage stage;
+
+public:
+	explicit TraceSpan(Stage stage) : trace(handlerTrace), stage(stage) { if (trace) trace->begin(stage); }
+	~TraceSpan() { if (trace) trace->end(stage); }
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan &operator=(const TraceSpan&) = delete;
+};
+
+/*
+ * Decides which requests are traced and keeps the finished ones.
+ *
+ * A config.trace_rate share of requests is picked at random when they
+ * arrive. With config.trace_slow set every request is timed, and those
+ * that took at least that long are kept whether picked or not; that is
+ * the only setting that costs anything for requests nobody looks at.
+ *
+ * Kept requests go into a ring buffer of config.trace_buffer requests on
+ * the thread that finished them, the oldest overwritten first. render()
+ * merges every thread's buffer into Chrome's trace event format, which
+ * chrome://tracing and Perfetto open as they are.
+ */
+class Tracer {
+public:
+	bool enabled() const;
+	// Resets trace and decides whether this request is traced
+	void start(RequestTrace &trace);
+	// Keeps the request if it was picked or slow enough
+	void finish(const RequestTrace &trace);
+
+	// The kept requests as an array of trace events, oldest first
+	void render(JsonWriter &json);
+
+private:
+	struct Ring {
+		std::mutex lock;
+		std::vector<RequestTrace> requests;
+		size_t next = 0;
+	};
+
+	std::mutex lock;
+	std::vector<std::unique_ptr<Ring>> rings;
+
+	Ring &mine();
+};
+
+extern Tracer tracer;
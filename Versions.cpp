@@ -0,0 +1,35 @@
+#include "Versions.h"
+#include <openssl/sha.h>
+
+TableVersions tableVersions;
+
+TableVersions::TableVersions() {
+	epoch = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void TableVersions::bump(unsigned int tables) {
+	for (unsigned int i = 0; i < Tables::Count; i++) {
+		if (tables & (1u << i)) counters[i].value.fetch_add(1, std::memory_order_release);
+	}
+}
+
+std::string TableVersions::etag(unsigned int tables, std::string_view target) const {
+	// The first 128 bits of a SHA-256 of the target, so two targets sharing
+	// a tag would take a collision nobody is going to find
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	SHA256((const unsigned char *)target.data(), target.size(), digest);
+
+	static const char hex[] = "0123456789abcdef";
+	char text[64];
+	int size = snprintf(text, sizeof(text), "\"%llx-", (unsigned long long)epoch);
+	std::string tag(text, size);
+	for (unsigned int i = 0; i < 16; i++) {
+		tag += hex[digest[i] >> 4];
+		tag += hex[digest[i] & 0xf];
+	}
+	for (unsigned int i = 0; i < Tables::Count; i++) {
+		if (tables & (1u << i)) tag += '-' + std::to_string(counters[i].value.load(std::memory_order_acquire));
+	}
+	tag += '"';
+	return tag;
+}
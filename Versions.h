@@ -0,0 +1,47 @@
+#pragma once
+#include "Util.h"
+
+/*
+ * Groups of tables whose contents read-only actions return. An action's
+ * entry says which of these it depends on (reads) or changes (writes).
+ */
+namespace Tables {
+	enum : unsigned int {
+		Catalog = 1u << 0, // Movies and Theaters
+		Seats   = 1u << 1,
+		Reviews = 1u << 2,
+	};
+	constexpr unsigned int Count = 3;
+}
+
+/*
+ * A version counter per group of tables, moved on by every write to it once
+ * the write has committed. A response built while a group was at version v
+ * is still current for as long as the group stays at v, so the ETag of a
+ * read is a digest of its target and the versions of the groups it depends
+ * on.
+ *
+ * Counters restart at zero with the server, so tags also carry the time it
+ * started; a tag from before a restart never matches.
+ */
+class TableVersions {
+public:
+	TableVersions();
+
+	// Called after the change is committed, never before
+	void bump(unsigned int tables);
+
+	// Tag for a response to target that reads tables. Take it before reading
+	// anything, so the tag is never newer than the data it is sent with.
+	std::string etag(unsigned int tables, std::string_view target) const;
+
+private:
+	// Own cache line each, Seats moves with every ticket sold
+	struct alignas(64) Counter {
+		std::atomic<uint64_t> value{0};
+	};
+	Counter counters[Tables::Count];
+	uint64_t epoch;
+};
+
+extern TableVersions tableVersions;
@@ -0,0 +1,55 @@
+#include "WorkerPool.h"
+
+WorkerPool hashPool;
+
+void WorkerPool::start(unsigned int count, size_t maxQueued) {
+	this->maxQueued = maxQueued;
+	stopping = false;
+	threads.reserve(count);
+	for (unsigned int i = 0; i < count; i++)
+		threads.emplace_back([this] { work(); });
+}
+
+void WorkerPool::stop() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+		jobs.clear();
+	}
+	ready.notify_all();
+	for (auto &thread : threads) thread.join();
+	threads.clear();
+}
+
+bool WorkerPool::submit(std::function<void()> job) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (stopping || jobs.size() >= maxQueued) {
+			rejected.fetch_add(1, std::memory_order_relaxed);
+			return(false);
+		}
+		jobs.push_back(std::move(job));
+	}
+	ready.notify_one();
+	return(true);
+}
+
+size_t WorkerPool::queued() {
+	std::lock_guard<std::mutex> guard(lock);
+	return jobs.size();
+}
+
+void WorkerPool::work() {
+	for (;;) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			ready.wait(guard, [this] { return stopping || !jobs.empty(); });
+			if (stopping) return;
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		job();
+		completed.fetch_add(1, std::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "Util.h"
+
+/*
+ * A fixed set of threads working through a bounded queue of jobs, for work
+ * that is too slow to do on the threads running the io_context.
+ *
+ * submit() never blocks: once the queue is full it refuses the job and the
+ * caller should answer "busy" instead. stop() lets the running jobs finish
+ * and drops whatever is still queued.
+ */
+class WorkerPool {
+	std::mutex lock;
+	std::condition_variable ready;
+	std::deque<std::function<void()>> jobs;
+	std::vector<std::thread> threads;
+	size_t maxQueued = 0;
+	bool stopping = false;
+
+	std::atomic<uint64_t> completed{0};
+	std::atomic<uint64_t> rejected{0};
+
+public:
+	~WorkerPool() { stop(); }
+
+	void start(unsigned int count, size_t maxQueued);
+	void stop();
+	bool submit(std::function<void()> job);
+
+	size_t queued();
+	uint64_t jobsCompleted() const { return completed.load(std::memory_order_relaxed); }
+	uint64_t jobsRejected() const { return rejected.load(std::memory_order_relaxed); }
+
+private:
+	void work();
+};
+
+// Runs password hashing and everything that waits on it
+extern WorkerPool hashPool;
@@ -0,0 +1,154 @@
+#include "WritePipeline.h"
+#include "Config.h"
+
+WritePipeline writePipeline;
+
+static void raiseMax(std::atomic<uint64_t> &max, uint64_t value) {
+	uint64_t seen = max.load(std::memory_order_relaxed);
+	while (value > seen && !max.compare_exchange_weak(seen, value, std::memory_order_relaxed));
+}
+
+void WritePipeline::start(ConnectionPool &pool, std::function<void(Connection&)> onFailedBatch, Post post) {
+	this->pool = &pool;
+	this->onFailedBatch = std::move(onFailedBatch);
+	this->post = std::move(post);
+	stopping = false;
+	thread = std::thread([this] { work(); });
+}
+
+void WritePipeline::stop() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	ready.notify_one();
+	if (thread.joinable()) thread.join();
+}
+
+void WritePipeline::submit(Op op, Done done) {
+	size_t waiting;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		pending.push_back({std::move(op), std::move(done), std::string()});
+		waiting = pending.size();
+	}
+	// Wake the pipeline for the first write of a batch and when a batch is full
+	if (waiting == 1 || waiting >= config.batch_size) ready.notify_one();
+}
+
+void WritePipeline::afterCommit(Hook hook) {
+	hooks.push_back(std::move(hook));
+}
+
+size_t WritePipeline::queued() {
+	std::lock_guard<std::mutex> guard(lock);
+	return pending.size();
+}
+
+WritePipeline::Stats WritePipeline::stats() {
+	return {
+		batches.load(std::memory_order_relaxed),
+		writes.load(std::memory_order_relaxed),
+		failedBatches.load(std::memory_order_relaxed),
+		maxBatch.load(std::memory_order_relaxed),
+		totalCommitMicros.load(std::memory_order_relaxed),
+		maxCommitMicros.load(std::memory_order_relaxed),
+	};
+}
+
+void WritePipeline::work() {
+	std::vector<Pending> batch;
+	batch.reserve(config.batch_size);
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			ready.wait(guard, [this] { return stopping || !pending.empty(); });
+			// Only stops once everything queued has been committed
+			if (pending.empty()) return;
+
+			// Let the batch fill up for a moment, unless it already has
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(config.batch_window);
+			ready.wait_until(guard, deadline, [this] { return stopping || pending.size() >= config.batch_size; });
+
+			size_t count = std::min(pending.size(), (size_t)config.batch_size);
+			for (size_t i = 0; i < count; i++) {
+				batch.push_back(std::move(pending.front()));
+				pending.pop_front();
+			}
+		}
+
+		commitBatch(batch);
+		batch.clear();
+	}
+}
+
+/*
+ * Runs one write inside its own savepoint. A write that throws has its
+ * changes and hooks dropped and is answered with an error, the rest of the
+ * batch goes on. False if SQLite rolled back the whole transaction, in
+ * which case nothing more may run before the batch is given up.
+ */
+bool WritePipeline::runOp(Connection &conn, Pending &write) {
+	size_t hookCount = hooks.size();
+	{
+		Transaction savepoint(conn);
+		if (!savepoint) return(false);
+		try {
+			write.body = write.op(conn);
+			savepoint.commit();
+		} catch (const std::exception &e) {
+			std::cerr << "Write failed: " << e.what() << "\n";
+			write.body = "{\"request\": \"1\", \"message\": \"Failed to save changes.\"}";
+			hooks.resize(hookCount);
+		}
+	}
+	return !sqlite3_get_autocommit(conn.db);
+}
+
+void WritePipeline::commitBatch(std::vector<Pending> &batch) {
+	auto start = std::chrono::steady_clock::now();
+	bool committed = false;
+	{
+		auto conn = pool->acquire();
+		{
+			Transaction txn(*conn);
+			if (txn) {
+				committed = true;
+				for (Pending &write : batch) {
+					if (!runOp(*conn, write)) {
+						committed = false;
+						break;
+					}
+				}
+				committed = committed && txn.commit();
+			}
+		}
+
+		if (committed) {
+			for (Hook &hook : hooks) hook(*conn);
+		} else {
+			std::cerr << "Write batch failed: " << sqlite3_errmsg(conn->db) << "\n";
+			failedBatches.fetch_add(1, std::memory_order_relaxed);
+			for (Pending &write : batch) write.body = "{\"request\": \"1\", \"message\": \"Failed to save changes.\"}";
+			if (onFailedBatch) onFailedBatch(*conn);
+		}
+		hooks.clear();
+	}
+	uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+	batches.fetch_add(1, std::memory_order_relaxed);
+	writes.fetch_add(batch.size(), std::memory_order_relaxed);
+	totalCommitMicros.fetch_add(micros, std::memory_order_relaxed);
+	raiseMax(maxBatch, batch.size());
+	raiseMax(maxCommitMicros, micros);
+
+	for (Pending &write : batch) {
+		if (!write.done) continue;
+		if (!post) {
+			write.done(std::move(write.body));
+			continue;
+		}
+		post([done = std::move(write.done), body = std::move(write.body)]() mutable { done(std::move(body)); });
+	}
+}
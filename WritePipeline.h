@@ -0,0 +1,92 @@
+#pragma once
+#include "Util.h"
+#include "Database.h"
+
+/*
+ * Every write goes through here. One thread owns the read-write connection
+ * and runs queued writes in batches: it waits until config.batch_size
+ * writes are queued or config.batch_window has passed since the first one,
+ * runs them all inside a single transaction and commits once. The cost of
+ * the commit is shared by the whole batch instead of paid per request.
+ *
+ * A write only hears its result after its batch has committed. Each write
+ * runs in its own savepoint, so one that throws is undone and answered
+ * with an error without taking the batch down. If the commit fails, or
+ * SQLite gives up the transaction part way through, the whole batch is
+ * rolled back, every write in it is told so, and onFailedBatch gets the
+ * chance to resync anything kept in memory.
+ * Results are handed to post to be delivered, so building the responses
+ * doesn't hold up the next batch.
+ *
+ * Anything a write changes outside the database (caches, sessions, the
+ * admin set) belongs in afterCommit(), so nobody sees it before it is
+ * committed and it never happens if the batch is rolled back.
+ *
+ * Writes that need more than one statement should use a Transaction, which
+ * becomes a savepoint inside the batch.
+ */
+class WritePipeline {
+public:
+	using Op = std::function<std::string(Connection &conn)>;
+	using Done = std::function<void(std::string body)>;
+	using Hook = std::function<void(Connection &conn)>;
+	// Runs a job somewhere else, e.g. on the io_context
+	using Post = std::function<void(std::function<void()> job)>;
+
+	struct Stats {
+		uint64_t batches;
+		uint64_t writes;
+		uint64_t failedBatches;
+		uint64_t maxBatch;
+		uint64_t totalCommitMicros;
+		uint64_t maxCommitMicros;
+	};
+
+	// Without post, results are delivered on the pipeline thread
+	void start(ConnectionPool &pool, std::function<void(Connection&)> onFailedBatch, Post post = nullptr);
+	// Commits whatever is still queued, then stops
+	void stop();
+
+	// done may be empty
+	void submit(Op op, Done done);
+
+	// Only from inside an op: runs hook on the pipeline thread once the
+	// batch has committed, before any write in it hears its result. Hooks
+	// run in the order they were added, and not at all on a rollback.
+	void afterCommit(Hook hook);
+
+	size_t queued();
+	Stats stats();
+
+private:
+	struct Pending {
+		Op op;
+		Done done;
+		std::string body;
+	};
+
+	std::mutex lock;
+	std::condition_variable ready;
+	std::deque<Pending> pending;
+	bool stopping = false;
+	std::thread thread;
+
+	ConnectionPool *pool = nullptr;
+	std::function<void(Connection&)> onFailedBatch;
+	Post post;
+	// Added by the batch being run, only touched on the pipeline thread
+	std::vector<Hook> hooks;
+
+	std::atomic<uint64_t> batches{0};
+	std::atomic<uint64_t> writes{0};
+	std::atomic<uint64_t> failedBatches{0};
+	std::atomic<uint64_t> maxBatch{0};
+	std::atomic<uint64_t> totalCommitMicros{0};
+	std::atomic<uint64_t> maxCommitMicros{0};
+
+	void work();
+	bool runOp(Connection &conn, Pending &write);
+	void commitBatch(std::vector<Pending> &batch);
+};
+
+extern WritePipeline writePipeline;
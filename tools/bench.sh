@@ -0,0 +1,28 @@
+#!/bin/sh
+# Starts a server on a scratch database, runs the load generator against
+# it and stops the server again. Used by `make bench`, which passes:
+#   $1 server binary, $2 load generator, $3 port, rest: load generator options
+set -e
+
+SERVER=$(realpath "$1")
+LOADGEN=$(realpath "$2")
+PORT=$3
+shift 3
+
+# The server keeps its database in the working directory, so give it its own
+RUN=bench-run
+rm -rf "$RUN"
+mkdir -p "$RUN"
+cd "$RUN"
+
+"$SERVER" -p "$PORT" > server.log 2>&1 &
+PID=$!
+trap 'kill $PID 2>/dev/null; wait $PID 2>/dev/null || true' EXIT
+
+# Wait for it to start listening
+for i in $(seq 50); do
+	grep -q "Server listening" server.log 2>/dev/null && break
+	sleep 0.1
+done
+
+"$LOADGEN" --port "$PORT" --output ../bench.json "$@"
@@ -0,0 +1,571 @@
+/*
+ * Load generator for the backend. Drives a weighted mix of actions over
+ * many keep-alive connections at a fixed arrival rate and writes
+ * throughput and latency percentiles per action to a JSON file.
+ *
+ * The load is open loop: requests are due at start + n / rate whether or
+ * not earlier ones have been answered. A request that has to wait for a
+ * free connection is timed from when it was due, not from when it was
+ * sent, so a server that falls behind shows it in the tail latencies
+ * instead of quietly being sent less work. Arrivals still waiting for a
+ * connection when the grace period runs out are reported as unsent, and
+ * requests still unanswered then count as errors.
+ *
+ *   tools/MbsLoad --port 4600 --rate 2000 --duration 10 --mix listmovies=5,buyticket=1
+ *
+ * Everything it needs (a theater, a showing, a user with payment details)
+ * is created through the API before the clock starts, logged in as the
+ * default admin.
+ */
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/asio.hpp>
+#include <bits/stdc++.h>
+#include <argp.h>
+#include <unistd.h>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+//################################################
+// settings
+
+struct Settings {
+	std::string host = "127.0.0.1";
+	std::string port = "4600";
+	double rate = 1000;           // requests per second
+	double duration = 10;         // seconds of load, after setup
+	unsigned int connections = 64;
+	std::string mix = "listmovies=40,getmovie=20,gettheater=5,reviewlist=5,search=10,getticket=5,buyticket=10,accdetails=5";
+	std::string out = "bench.json";
+	double grace = 5;             // seconds to wait for stragglers once the load stops
+};
+
+static Settings settings;
+
+//################################################
+// setup
+
+static std::string urlEncode(std::string_view text) {
+	static const char hex[] = "0123456789ABCDEF";
+	std::string out;
+	for (unsigned char c : text) {
+		if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') out += c;
+		else {
+			out += '%';
+			out += hex[c >> 4];
+			out += hex[c & 0xf];
+		}
+	}
+	return out;
+}
+
+/*
+ * Pulls "key": value out of a response body. Only good for the flat
+ * responses setup reads, not a JSON parser.
+ */
+static std::string jsonField(const std::string &body, std::string_view key) {
+	std::string needle = "\"" + std::string(key) + "\":";
+	size_t pos = body.find(needle);
+	if (pos == std::string::npos) return "";
+	pos += needle.size();
+	while (pos < body.size() && body[pos] == ' ') pos++;
+	if (pos < body.size() && body[pos] == '"') {
+		size_t end = body.find('"', pos + 1);
+		return body.substr(pos + 1, end - pos - 1);
+	}
+	size_t end = body.find_first_of(",}", pos);
+	return body.substr(pos, end - pos);
+}
+
+// One blocking request on its own connection, for setup
+static std::string fetch(asio::io_context &ioc, const std::string &target) {
+	tcp::resolver resolver(ioc);
+	beast::tcp_stream stream(ioc);
+	stream.connect(resolver.resolve(settings.host, settings.port));
+
+	http::request<http::empty_body> req(http::verb::get, target, 11);
+	req.set(http::field::host, settings.host);
+	http::write(stream, req);
+
+	beast::flat_buffer buffer;
+	http::response<http::string_body> res;
+	http::read(stream, buffer, res);
+	beast::error_code ec;
+	stream.socket().shutdown(tcp::socket::shutdown_both, ec);
+	return res.body();
+}
+
+/*
+ * A target for every action the generator knows, filled in with what
+ * setup created. delacc and logout are left out, they would end the
+ * session everything else runs under. {n} becomes a number no other
+ * request in the run gets: reviewadd uses it as the movie id, since a
+ * user can only review a movie once.
+ */
+static std::map<std::string, std::string> buildTargets(asio::io_context &ioc) {
+	std::string tag = std::to_string(getpid());
+
+	std::string admin = jsonField(fetch(ioc, "/?action=verifyacc&email=admin&password=admin"), "token");
+	if (admin.empty()) throw std::runtime_error("can't log in as the default admin");
+
+	std::string theaterName = "bench-" + tag;
+	std::string theater = jsonField(fetch(ioc, "/?action=addtheater&token=" + admin + "&theater_name=" + theaterName), "theater_id");
+	std::string movie = jsonField(fetch(ioc, "/?action=addmovie&token=" + admin + "&movie_name=Bench%20Movie%20" + tag +
+		"&showtime=2099-01-01&price=10&rating=PG&theater_id=" + theater + "&capacity=1000000000"), "movie_id");
+	if (theater.empty() || movie.empty()) throw std::runtime_error("can't create the bench theater and showing");
+
+	std::string email = "bench-" + tag + "@load.test";
+	fetch(ioc, "/?action=createacc&email=" + urlEncode(email) + "&password=bench&name=bench&payment_details=card");
+	std::string user = jsonField(fetch(ioc, "/?action=verifyacc&email=" + urlEncode(email) + "&password=bench"), "token");
+	if (user.empty()) throw std::runtime_error("can't create the bench user");
+
+	return {
+		{"createacc",     "/?action=createacc&email=" + urlEncode("new-" + tag + "-{n}@load.test") + "&password=bench&name=bench"},
+		{"verifyacc",     "/?action=verifyacc&email=" + urlEncode(email) + "&password=bench"},
+		{"buyticket",     "/?action=buyticket&token=" + user + "&movie_id=" + movie + "&ticket_amount=1"},
+		{"getticket",     "/?action=getticket&token=" + user + "&limit=20"},
+		{"accdetails",    "/?action=accdetails&token=" + user},
+		{"checkadmin",    "/?action=checkadmin&token=" + user},
+		{"updatepayment", "/?action=updatepayment&token=" + user + "&payment_details=card"},
+		{"reviewadd",     "/?action=reviewadd&token=" + user + "&movie_id=" + urlEncode("{n}") + "&review=bench"},
+		{"listmovies",    "/?action=listmovies&limit=20"},
+		{"getmovie",      "/?action=getmovie&movie_id=" + movie},
+		{"gettheater",    "/?action=gettheater&theater_name=" + theaterName},
+		{"reviewlist",    "/?action=reviewlist&movie_id=" + movie},
+		{"search",        "/?action=search&q=bench"},
+		{"addmovie",      "/?action=addmovie&token=" + admin + "&movie_name=Bench%20Extra&showtime=2099-01-02&price=10&rating=PG&theater_id=" + theater},
+		{"delmovie",      "/?action=delmovie&token=" + admin + "&movie_id=0"},
+		{"addtheater",    "/?action=addtheater&token=" + admin + "&theater_name=bench-extra"},
+		{"deltheater",    "/?action=deltheater&token=" + admin + "&theater_id=0"},
+		{"adminadd",      "/?action=adminadd&token=" + admin + "&target=nobody"},
+		{"admindel",      "/?action=admindel&token=" + admin + "&target=nobody"},
+		{"genreport",     "/?action=genreport&token=" + admin + "&limit=20"},
+		{"stats",         "/?action=stats&token=" + admin},
+	};
+}
+
+//################################################
+// load
+
+struct Action {
+	std::string name;
+	std::string target;
+	unsigned int weight;
+
+	std::vector<uint32_t> latencies; // µs, answered requests only
+	uint64_t failed = 0;             // answered with "request": "1"
+	uint64_t errors = 0;             // not 200, the connection broke, or no answer in time
+	uint64_t unsent = 0;             // came due, but no connection was free in time
+	uint64_t inFlight = 0;
+};
+
+struct Arrival {
+	size_t action;
+	Clock::time_point due;
+};
+
+class Generator;
+
+/*
+ * One keep-alive connection. Sends one request at a time and hands itself
+ * back to the generator when the response is in.
+ */
+class Connection : public std::enable_shared_from_this<Connection> {
+	Generator &gen;
+	beast::tcp_stream stream;
+	beast::flat_buffer buffer;
+	http::request<http::empty_body> req;
+	http::response<http::string_body> res;
+	Arrival current{};
+
+public:
+	Connection(Generator &gen, asio::io_context &ioc) : gen(gen), stream(ioc) {}
+
+	void connect(const tcp::resolver::results_type &endpoints, std::function<void(bool)> done);
+	void send(const Arrival &arrival);
+
+private:
+	void onWrite(beast::error_code ec);
+	void onRead(beast::error_code ec);
+	void reconnect(bool lost);
+};
+
+class Generator {
+public:
+	std::vector<Action> actions;
+
+	Generator(asio::io_context &ioc) : ioc(ioc), timer(ioc) {}
+
+	// Returns once everything is answered or the grace period is over
+	void run();
+	// Counts whatever run() left queued as unsent, and left in flight as errors
+	void abandon();
+	void finished(Connection *conn, const Arrival &arrival, bool ok, bool failed);
+	// lost is the request that went down with the connection, if any
+	void broken(Connection *conn, const Arrival *lost);
+	const std::string &targetFor(const Arrival &arrival);
+
+	Clock::time_point start;
+	Clock::time_point end;
+	uint64_t sent = 0;
+
+private:
+	asio::io_context &ioc;
+	asio::steady_timer timer;
+	std::vector<std::shared_ptr<Connection>> connections;
+	std::deque<Connection*> idle;
+	std::deque<Arrival> pending;
+	std::vector<unsigned int> cumulative; // running weight totals, for picking an action
+	std::mt19937_64 rng{std::random_device{}()};
+	uint64_t issued = 0;
+	uint64_t outstanding = 0;
+	bool stopping = false;
+	std::string scratch;
+
+	void tick();
+	void dispatch();
+	void checkDone();
+};
+
+void Connection::connect(const tcp::resolver::results_type &endpoints, std::function<void(bool)> done) {
+	stream.async_connect(endpoints, [self = shared_from_this(), done](beast::error_code ec, const tcp::endpoint&) {
+		if (!ec) self->stream.socket().set_option(tcp::no_delay(true));
+		done(!ec);
+	});
+}
+
+void Connection::send(const Arrival &arrival) {
+	current = arrival;
+	req = {};
+	req.method(http::verb::get);
+	req.target(gen.targetFor(arrival));
+	req.version(11);
+	req.set(http::field::host, settings.host);
+	req.keep_alive(true);
+	http::async_write(stream, req, [self = shared_from_this()](beast::error_code ec, size_t) { self->onWrite(ec); });
+}
+
+void Connection::onWrite(beast::error_code ec) {
+	if (ec) return reconnect(true);
+	res = {};
+	http::async_read(stream, buffer, res, [self = shared_from_this()](beast::error_code ec, size_t) { self->onRead(ec); });
+}
+
+void Connection::onRead(beast::error_code ec) {
+	if (ec) return reconnect(true);
+	bool ok = res.result() == http::status::ok || res.result() == http::status::not_modified;
+	bool failed = ok && res.body().find("\"request\":\"1\"") != std::string::npos;
+	failed = failed || (ok && res.body().find("\"request\": \"1\"") != std::string::npos);
+	if (!res.keep_alive()) {
+		gen.finished(nullptr, current, ok, failed);
+		return reconnect(false);
+	}
+	gen.finished(this, current, ok, failed);
+}
+
+// The server closed on us, start over on a fresh socket
+void Connection::reconnect(bool lost) {
+	beast::error_code ec;
+	stream.socket().close(ec);
+	buffer.clear();
+	gen.broken(this, lost ? &current : nullptr);
+}
+
+const std::string &Generator::targetFor(const Arrival &arrival) {
+	const std::string &target = actions[arrival.action].target;
+	size_t n = target.find("%7Bn%7D");
+	if (n == std::string::npos) return target;
+	// Actions that need something unique each time, like a new account's email
+	scratch = target;
+	scratch.replace(n, 7, std::to_string(sent));
+	return scratch;
+}
+
+void Generator::run() {
+	for (const Action &action : actions)
+		cumulative.push_back((cumulative.empty() ? 0 : cumulative.back()) + action.weight);
+
+	tcp::resolver resolver(ioc);
+	auto endpoints = resolver.resolve(settings.host, settings.port);
+
+	// Open every connection before the clock starts
+	size_t connected = 0, attempted = 0;
+	for (unsigned int i = 0; i < settings.connections; i++) {
+		auto conn = std::make_shared<Connection>(*this, ioc);
+		connections.push_back(conn);
+		conn->connect(endpoints, [this, conn, &connected, &attempted](bool ok) {
+			attempted++;
+			if (ok) {
+				connected++;
+				idle.push_back(conn.get());
+			}
+			if (attempted == settings.connections) {
+				if (!connected) {
+					std::cerr << "Couldn't connect to " << settings.host << ":" << settings.port << "\n";
+					return ioc.stop();
+				}
+				start = Clock::now();
+				end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(settings.duration));
+				tick();
+			}
+		});
+	}
+	ioc.run();
+}
+
+void Generator::abandon() {
+	for (const Arrival &arrival : pending) actions[arrival.action].unsent++;
+	pending.clear();
+	for (Action &action : actions) {
+		action.errors += action.inFlight;
+		action.inFlight = 0;
+	}
+	outstanding = 0;
+}
+
+/*
+ * Queues every arrival that has come due since the last tick, then sleeps
+ * until the next one. Arrivals are worked out from the start time, so a
+ * late tick catches up rather than drifting.
+ */
+void Generator::tick() {
+	Clock::time_point now = Clock::now();
+	Clock::time_point until = std::min(now, end);
+	uint64_t due = (uint64_t)(std::chrono::duration<double>(until - start).count() * settings.rate);
+
+	std::uniform_int_distribution<unsigned int> pick(0, cumulative.back() - 1);
+	for (; issued < due; issued++) {
+		unsigned int roll = pick(rng);
+		size_t action = std::upper_bound(cumulative.begin(), cumulative.end(), roll) - cumulative.begin();
+		Clock::time_point at = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(issued / settings.rate));
+		pending.push_back({action, at});
+	}
+	dispatch();
+
+	if (now >= end) {
+		stopping = true;
+		// Give what is still queued or in flight a little while to finish
+		timer.expires_at(end + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(settings.grace)));
+		timer.async_wait([this](beast::error_code ec) { if (!ec) ioc.stop(); });
+		return checkDone();
+	}
+
+	Clock::time_point next = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((issued + 1) / settings.rate));
+	timer.expires_at(std::min(next, end));
+	timer.async_wait([this](beast::error_code ec) { if (!ec) tick(); });
+}
+
+void Generator::dispatch() {
+	while (!idle.empty() && !pending.empty()) {
+		Connection *conn = idle.front();
+		idle.pop_front();
+		Arrival arrival = pending.front();
+		pending.pop_front();
+		outstanding++;
+		actions[arrival.action].inFlight++;
+		sent++;
+		conn->send(arrival);
+	}
+}
+
+void Generator::finished(Connection *conn, const Arrival &arrival, bool ok, bool failed) {
+	outstanding--;
+	Action &action = actions[arrival.action];
+	action.inFlight--;
+	if (ok) {
+		action.latencies.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - arrival.due).count());
+		if (failed) action.failed++;
+	} else {
+		action.errors++;
+	}
+	if (conn) idle.push_back(conn);
+	dispatch();
+	checkDone();
+}
+
+void Generator::broken(Connection *conn, const Arrival *lost) {
+	if (lost) {
+		outstanding--;
+		actions[lost->action].inFlight--;
+		actions[lost->action].errors++;
+	}
+
+	// Replace it, the old one goes once its last handler returns
+	for (auto &slot : connections) {
+		if (slot.get() != conn) continue;
+		slot = std::make_shared<Connection>(*this, ioc);
+		tcp::resolver resolver(ioc);
+		slot->connect(resolver.resolve(settings.host, settings.port), [this, fresh = slot.get()](bool ok) {
+			if (ok) {
+				idle.push_back(fresh);
+				dispatch();
+			}
+		});
+		break;
+	}
+	checkDone();
+}
+
+void Generator::checkDone() {
+	if (stopping && pending.empty() && !outstanding) {
+		timer.cancel();
+		ioc.stop();
+	}
+}
+
+//################################################
+// report
+
+static uint32_t percentile(const std::vector<uint32_t> &sorted, double p) {
+	if (sorted.empty()) return 0;
+	size_t index = (size_t)std::ceil(p * sorted.size()) - 1;
+	return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static void writeStats(std::ostream &out, std::vector<uint32_t> &latencies, uint64_t failed, uint64_t errors, uint64_t unsent, double seconds) {
+	std::sort(latencies.begin(), latencies.end());
+	out << "{\"count\": " << latencies.size()
+		<< ", \"failed\": " << failed
+		<< ", \"errors\": " << errors
+		<< ", \"unsent\": " << unsent
+		<< ", \"throughput\": " << (seconds > 0 ? latencies.size() / seconds : 0)
+		<< ", \"p50_us\": " << percentile(latencies, 0.50)
+		<< ", \"p99_us\": " << percentile(latencies, 0.99)
+		<< ", \"p999_us\": " << percentile(latencies, 0.999)
+		<< ", \"max_us\": " << (latencies.empty() ? 0 : latencies.back())
+		<< "}";
+}
+
+static void writeReport(Generator &gen, double seconds) {
+	std::ofstream out(settings.out);
+	if (!out) throw std::runtime_error("can't write " + settings.out);
+
+	std::vector<uint32_t> all;
+	uint64_t failed = 0, errors = 0, unsent = 0;
+
+	out << "{\n\t\"rate\": " << settings.rate
+		<< ",\n\t\"duration_s\": " << seconds
+		<< ",\n\t\"connections\": " << settings.connections
+		<< ",\n\t\"sent\": " << gen.sent
+		<< ",\n\t\"actions\": {";
+	bool first = true;
+	for (Action &action : gen.actions) {
+		all.insert(all.end(), action.latencies.begin(), action.latencies.end());
+		failed += action.failed;
+		errors += action.errors;
+		unsent += action.unsent;
+
+		out << (first ? "\n\t\t\"" : ",\n\t\t\"") << action.name << "\": ";
+		writeStats(out, action.latencies, action.failed, action.errors, action.unsent, seconds);
+		first = false;
+
+		std::cout << std::left << std::setw(14) << action.name << std::right
+			<< " n=" << std::setw(8) << action.latencies.size()
+			<< " p50=" << std::setw(7) << percentile(action.latencies, 0.50) << "us"
+			<< " p99=" << std::setw(7) << percentile(action.latencies, 0.99) << "us"
+			<< " p999=" << std::setw(7) << percentile(action.latencies, 0.999) << "us"
+			<< " failed=" << action.failed << " errors=" << action.errors << " unsent=" << action.unsent << "\n";
+	}
+	out << "\n\t},\n\t\"total\": ";
+	writeStats(out, all, failed, errors, unsent, seconds);
+	out << "\n}\n";
+
+	std::cout << "total: " << all.size() << " answered in " << seconds << "s, "
+		<< (seconds > 0 ? all.size() / seconds : 0) << " req/s, p99 " << percentile(all, 0.99) << "us, "
+		<< errors << " errors, " << unsent << " unsent -> " << settings.out << "\n";
+}
+
+//################################################
+// command line
+
+enum {
+	OPT_RATE = 256,
+	OPT_DURATION,
+	OPT_CONNECTIONS,
+	OPT_MIX,
+	OPT_GRACE,
+};
+
+static struct argp_option options[] = {
+	{"host",        'H',             "HOST",  0, "Server address (default: 127.0.0.1)", 0},
+	{"port",        'p',             "PORT",  0, "Server port (default: 4600)", 0},
+	{"output",      'o',             "FILE",  0, "Where to write the JSON results (default: bench.json)", 0},
+	{"rate",        OPT_RATE,        "RPS",   0, "Requests per second to send, whatever the server manages (default: 1000)", 0},
+	{"duration",    OPT_DURATION,    "SECONDS", 0, "How long to send for (default: 10)", 0},
+	{"connections", OPT_CONNECTIONS, "N",     0, "Keep-alive connections to spread requests over (default: 64)", 0},
+	{"mix",         OPT_MIX,         "LIST",  0, "action=weight,... to send (default: mostly reads with some buyticket)", 0},
+	{"grace",       OPT_GRACE,       "SECONDS", 0, "How long to wait for outstanding requests at the end (default: 5)", 0},
+	{0, 0, 0, 0, 0, 0}
+};
+
+static error_t parseOpt(int key, char *arg, struct argp_state *state) {
+	switch (key) {
+		case 'H': settings.host = arg; break;
+		case 'p': settings.port = arg; break;
+		case 'o': settings.out = arg; break;
+		case OPT_RATE:
+			if (atof(arg) <= 0) argp_error(state, "rate must be above 0");
+			settings.rate = atof(arg);
+			break;
+		case OPT_DURATION:
+			if (atof(arg) <= 0) argp_error(state, "duration must be above 0");
+			settings.duration = atof(arg);
+			break;
+		case OPT_CONNECTIONS:
+			if (atoi(arg) < 1) argp_error(state, "connections must be at least 1");
+			settings.connections = atoi(arg);
+			break;
+		case OPT_MIX: settings.mix = arg; break;
+		case OPT_GRACE: settings.grace = atof(arg); break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp argParser = {options, parseOpt, 0, "Load generator for the movie booking system backend", 0, 0, 0};
+
+//################################################
+int main(int argc, char *argv[]) {
+	argp_parse(&argParser, argc, argv, 0, 0, 0);
+
+	try {
+		asio::io_context ioc(1);
+		std::map<std::string, std::string> targets = buildTargets(ioc);
+
+		Generator gen(ioc);
+		std::stringstream mix(settings.mix);
+		std::string entry;
+		while (std::getline(mix, entry, ',')) {
+			size_t eq = entry.find('=');
+			std::string name = entry.substr(0, eq);
+			unsigned int weight = eq == std::string::npos ? 1 : atoi(entry.c_str() + eq + 1);
+			auto target = targets.find(name);
+			if (target == targets.end()) {
+				std::cerr << "Unknown action in mix: " << name << "\n";
+				return(1);
+			}
+			if (weight) gen.actions.push_back({name, target->second, weight, {}, 0, 0, 0, 0});
+		}
+		if (gen.actions.empty()) {
+			std::cerr << "Nothing to send, the mix is empty\n";
+			return(1);
+		}
+
+		std::cout << "Sending " << settings.rate << " req/s for " << settings.duration << "s over "
+			<< settings.connections << " connections to " << settings.host << ":" << settings.port << "\n";
+		gen.run();
+		gen.abandon();
+
+		double seconds = std::chrono::duration<double>(std::min(Clock::now(), gen.end) - gen.start).count();
+		writeReport(gen, seconds);
+	} catch (const std::exception &exception) {
+		std::cerr << "Error: " << exception.what() << "\n";
+		return(1);
+	}
+	return(0);
+}
@@ -0,0 +1,253 @@
+/*
+ * Microbenchmarks for the per-request path, one stage at a time: query
+ * parsing, action lookup, SQL, JSON building, whole handlers and the full
+ * handleRequest() round trip with the response made ready to send.
+ *
+ * Runs against an in-memory database migrated and seeded like a busy
+ * server, and reports time, allocations and bytes allocated per call.
+ * Allocations are counted by replacing the global operator new below.
+ *
+ *   make microbench                 every benchmark
+ *   tools/MbsBench json             only the ones with "json" in the name
+ */
+#include "../MbsBackend.h"
+#include <new>
+
+//################################################
+// allocation counting
+
+static thread_local uint64_t allocations = 0;
+static thread_local uint64_t allocatedBytes = 0;
+
+static void *countedAlloc(size_t size) {
+	allocations++;
+	allocatedBytes += size;
+	if (void *p = malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+static void *countedAlignedAlloc(size_t size, std::align_val_t align) {
+	allocations++;
+	allocatedBytes += size;
+	size_t alignment = (size_t)align;
+	// aligned_alloc wants the size rounded up to the alignment
+	if (void *p = aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)) return p;
+	throw std::bad_alloc();
+}
+
+void *operator new(size_t size) { return countedAlloc(size); }
+void *operator new[](size_t size) { return countedAlloc(size); }
+void *operator new(size_t size, std::align_val_t align) { return countedAlignedAlloc(size, align); }
+void *operator new[](size_t size, std::align_val_t align) { return countedAlignedAlloc(size, align); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { free(p); }
+
+//################################################
+// harness
+
+// Keeps the compiler from throwing away a result nobody reads
+template<typename T>
+static inline void keep(T &&value) {
+	asm volatile("" : : "g"(&value) : "memory");
+}
+
+static const char *filter = nullptr;
+
+/*
+ * Runs fn enough times to take about a quarter of a second, after a short
+ * warm up, and prints the cost of one call.
+ */
+template<typename Fn>
+static void bench(const char *name, Fn &&fn) {
+	if (filter && !strstr(name, filter)) return;
+	using Clock = std::chrono::steady_clock;
+
+	for (int i = 0; i < 100; i++) fn();
+
+	// Grow the batch until it is long enough to time
+	uint64_t iterations = 1;
+	for (;;) {
+		auto start = Clock::now();
+		for (uint64_t i = 0; i < iterations; i++) fn();
+		if (Clock::now() - start > std::chrono::milliseconds(25)) break;
+		iterations *= 2;
+	}
+	iterations *= 10;
+
+	uint64_t allocsBefore = allocations, bytesBefore = allocatedBytes;
+	auto start = Clock::now();
+	for (uint64_t i = 0; i < iterations; i++) fn();
+	double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+	printf("%-52s %12.1f ns/op %10.2f allocs/op %12.1f B/op\n", name, ns / iterations,
+		(double)(allocations - allocsBefore) / iterations, (double)(allocatedBytes - bytesBefore) / iterations);
+}
+
+//################################################
+// data
+
+static constexpr int userCount = 1000;
+static constexpr int theaterCount = 20;
+static constexpr int movieCount = 2000;
+static constexpr int ticketCount = 100000;
+static constexpr int reviewCount = 5000;
+
+/*
+ * Fills the database. User 1 is the heavy customer, with a ticket for
+ * every hundredth purchase; movie 1 gets a review from every user.
+ */
+static bool seed(Connection &conn) {
+	std::string sql = R"(
+		BEGIN;
+		WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < )" + std::to_string(theaterCount) + R"()
+			INSERT INTO Theaters (name) SELECT 'Theater ' || i FROM n;
+		WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < )" + std::to_string(userCount) + R"()
+			INSERT INTO Users (name, email, password, payment_details) SELECT 'User ' || i, 'user' || i || '@example.com', 'x', 'card' FROM n;
+		WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < )" + std::to_string(movieCount) + R"()
+			INSERT INTO Movies (name, showtime, price_per_ticket, rating, theater_id)
+				SELECT 'Movie ' || i || CASE i % 3 WHEN 0 THEN ' Returns' WHEN 1 THEN ' Reloaded' ELSE ' Rising' END,
+					'2026-' || printf('%02d', 1 + i % 12) || '-' || printf('%02d', 1 + i % 28),
+					5 + i % 10, CASE i % 5 WHEN 0 THEN 'G' WHEN 1 THEN 'PG' WHEN 2 THEN 'PG13' WHEN 3 THEN 'R' ELSE 'NC17' END,
+					1 + i % )" + std::to_string(theaterCount) + R"( FROM n;
+		INSERT INTO Seats (movie_id, capacity) SELECT id, 1000000 FROM Movies;
+		WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < )" + std::to_string(ticketCount) + R"()
+			INSERT INTO Tickets (user_id, movie_id, quantity, purchase_time)
+				SELECT CASE WHEN i % 100 = 0 THEN 1 ELSE 1 + i % )" + std::to_string(userCount) + R"( END,
+					1 + i % )" + std::to_string(movieCount) + R"(, 1 + i % 4, '1760000000' FROM n;
+		WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < )" + std::to_string(reviewCount) + R"()
+			INSERT INTO Reviews (user_id, movie_id, review)
+				SELECT 1 + (i - 1) % )" + std::to_string(userCount) + R"(, 1 + (i - 1) / )" + std::to_string(userCount) + R"(,
+					'Review ' || i || ', a fine film with a good story and better popcorn' FROM n;
+		COMMIT;
+	)";
+	char *errMsg = nullptr;
+	if (sqlite3_exec(conn.db, sql.c_str(), nullptr, nullptr, &errMsg) != SQLITE_OK) {
+		std::cerr << "Seeding failed: " << errMsg << "\n";
+		sqlite3_free(errMsg);
+		return(false);
+	}
+	return(true);
+}
+
+//################################################
+int main(int argc, char *argv[]) {
+	if (argc > 1) filter = argv[1];
+
+	// One in-memory connection, standing in for the reader pool handleRequest uses
+	if (!dbReaders.open(":memory:", 1, false)) return(1);
+	{
+		auto conn = dbReaders.acquire();
+		if (!runMigrations(conn->db) || !seed(*conn)) return(1);
+		if (!catalog.reload(*conn) || !seats.load(*conn)) return(1);
+	}
+	printf("%d users, %d theaters, %d movies, %d tickets, %d reviews\n\n",
+		userCount, theaterCount, movieCount, ticketCount, reviewCount);
+
+	// query parsing
+	const std::string plainQuery = "action=getticket&token=0123456789abcdef0123456789abcdef&movie_id=42&limit=20";
+	const std::string escapedQuery = "action=search&q=the%20matrix+reloaded&in=movies&limit=20";
+	bench("parse query", [&] { QueryParams params(plainQuery); keep(params); });
+	bench("parse query (escaped)", [&] { QueryParams params(escapedQuery); keep(params); });
+
+	// dispatch
+	bench("find action", [] { keep(findAction("getticket")); });
+	bench("find action (unknown)", [] { keep(findAction("nosuchaction")); });
+
+	// The only reader is checked out here and handed back before handleRequest needs it
+	{
+		auto conn = dbReaders.acquire();
+
+		// SQL on its own, then SQL and JSON, for a page of the heavy customer's tickets
+		auto ticketPage = [&](bool json) {
+			Statement stmt(*conn, Stmt::SelectTickets);
+			sqlite3_bind_int64(stmt, 1, 1);
+			sqlite3_bind_int64(stmt, 2, 0);
+			sqlite3_bind_int64(stmt, 3, 100);
+			if (!json) {
+				while (stmt.step() == SQLITE_ROW) keep(sqlite3_column_int64(stmt, 0));
+				return;
+			}
+			JsonWriter out(4096);
+			if (stmt.step() == SQLITE_ROW) out.beginObject().key("tickets").rows(stmt).endObject();
+			keep(out.str());
+		};
+		bench("sql: 100 tickets", [&] { ticketPage(false); });
+		bench("sql + json: 100 tickets", [&] { ticketPage(true); });
+
+		// JSON building without SQL
+		const CatalogSnapshot &snap = catalog.snapshot();
+		bench("json: 20 catalog movies", [&] {
+			JsonWriter out(16384);
+			out.beginObject().field("request", "0").field("message", "Success!").key("movies").beginArray();
+			for (size_t i = 0; i < 20; i++) out.raw(snap.movies[i].json);
+			out.endArray().endObject();
+			keep(out.str());
+		});
+
+		// handlers, called directly
+		Caller customer{1, false, {}};
+		Caller admin{1, true, {}};
+		auto handler = [&](const char *name, const std::string &query, const Caller &caller) {
+			const Action *action = findAction(name);
+			std::string label = std::string("handler: ") + name + " (" + query + ")";
+			bench(label.c_str(), [&] {
+				QueryParams params(query);
+				keep(action->handler(*conn, params, caller));
+			});
+		};
+		handler("listmovies", "limit=20", customer);
+		handler("listmovies", "movie_name=movie%201&limit=20", customer);
+		handler("getmovie", "movie_id=42", customer);
+		handler("getticket", "limit=100", customer);
+		handler("reviewlist", "movie_id=1&limit=100", customer);
+		handler("search", "q=reloa&limit=20", customer);
+		handler("genreport", "limit=100", admin);
+	}
+
+	// The whole path: parse, dispatch, handler, respond(), prepare_payload()
+	auto request = [](const std::string &target, const char *acceptEncoding, const char *ifNoneMatch) {
+		http::request<http::string_body> req{http::verb::get, target, 11};
+		if (acceptEncoding) req.set(http::field::accept_encoding, acceptEncoding);
+		if (ifNoneMatch) req.set(http::field::if_none_match, ifNoneMatch);
+		return req;
+	};
+	auto roundTrip = [&](const char *name, const http::request<http::string_body> &req) {
+		bench(name, [&] {
+			http::response<http::string_body> res;
+			handleRequest(req, res, [] {});
+			keep(res);
+		});
+	};
+	roundTrip("request: getmovie", request("/?action=getmovie&movie_id=42", nullptr, nullptr));
+	roundTrip("request: listmovies limit=100", request("/?action=listmovies&limit=100", nullptr, nullptr));
+	// listmovies has an ETag, so after the first call gzip comes out of the
+	// compressed cache unless it's turned off
+	unsigned int compressCache = config.compress_cache;
+	config.compress_cache = 0;
+	roundTrip("request: listmovies limit=100 gzip", request("/?action=listmovies&limit=100", "gzip", nullptr));
+	config.compress_cache = compressCache;
+	roundTrip("request: listmovies limit=100 gzip (cache hit)", request("/?action=listmovies&limit=100", "gzip", nullptr));
+
+	auto tagged = request("/?action=listmovies&limit=100", nullptr, nullptr);
+	http::response<http::string_body> first;
+	handleRequest(tagged, first, [] {});
+	std::string etag(first[http::field::etag]);
+	roundTrip("request: listmovies limit=100 304", request("/?action=listmovies&limit=100", nullptr, etag.c_str()));
+
+	bench("prepare_payload: 16 KiB body", [] {
+		http::response<http::string_body> res;
+		res.result(http::status::ok);
+		res.set(http::field::content_type, "application/json");
+		res.body().assign(16384, 'x');
+		res.prepare_payload();
+		keep(res);
+	});
+
+	return(0);
+}
@@ -0,0 +1,575 @@
+/*
+ * Fills a database with a large synthetic dataset, or with rows imported
+ * from CSV, fast enough for capacity tests.
+ *
+ *   tools/MbsPopulate --users 1000000 --tickets 5000000
+ *   tools/MbsPopulate --import Theaters=theaters.csv --import Movies=movies.csv
+ *
+ * The schema comes from the same migrations the server runs at startup, and
+ * rows go in through the server's own cached insert statements. Speed comes
+ * from the load settings: the rollback journal in memory, no syncs, a large
+ * page cache and a commit only every --batch rows. The file is put back in
+ * WAL mode and analyzed at the end, ready for the server. Nothing else may
+ * have the database open while this runs.
+ *
+ * Generated data is skewed the way real sales are: movies are ranked in a
+ * random order and sell in proportion to 1 / rank^skew, so with the default
+ * skew a handful of blockbusters take most of the tickets. Customers are
+ * skewed the same way, more gently. Every generated user's password is
+ * --password, hashed once and shared.
+ */
+#include "../MbsBackend.h"
+#include <argp.h>
+
+using Clock = std::chrono::steady_clock;
+
+//################################################
+// settings
+
+struct Settings {
+	std::string database = DATABASE_FILE;
+	// Rows to generate. Unset means the default, or none when importing.
+	std::optional<uint64_t> users, theaters, movies, tickets, reviews;
+	double skew = 1.2;            // how strongly sales favour the top movies
+	double userSkew = 0.6;        // same for customers
+	uint64_t capacity = 500;      // seats per showing, raised to whatever it sold
+	uint64_t seed = 42;
+	uint64_t batch = 100000;      // rows per transaction
+	unsigned int cache = 512;     // MiB of page cache while loading
+	std::string password = "password";
+	std::vector<std::pair<std::string, std::string>> imports; // table, file
+};
+
+static Settings settings;
+
+//################################################
+// loading
+
+/*
+ * Rows are counted as they go in, and every settings.batch of them the
+ * transaction is committed and a new one begun.
+ */
+class Loader {
+	Connection &conn;
+	std::optional<Transaction> txn;
+	uint64_t inBatch = 0;
+
+public:
+	explicit Loader(Connection &conn) : conn(conn) { txn.emplace(conn); }
+
+	explicit operator bool() const { return (bool)*txn; }
+
+	bool row() {
+		if (++inBatch < settings.batch) return(true);
+		inBatch = 0;
+		if (!txn->commit()) return(false);
+		txn.emplace(conn);
+		return (bool)*txn;
+	}
+
+	bool finish() { return txn->commit(); }
+};
+
+static void progress(const char *what, uint64_t rows, Clock::time_point start) {
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	std::cout << what << ": " << rows << " rows in " << std::fixed << std::setprecision(1) << seconds << "s ("
+		<< (uint64_t)(seconds > 0 ? rows / seconds : rows) << " rows/s)\n" << std::defaultfloat;
+}
+
+static bool failed(Connection &conn, const char *what) {
+	std::cerr << "Loading " << what << " failed: " << sqlite3_errmsg(conn.db) << "\n";
+	return(false);
+}
+
+// Like sqLiteExecute, without printing what the pragmas return
+static bool execute(Connection &conn, const std::string &sql) {
+	char *errMsg = nullptr;
+	if (sqlite3_exec(conn.db, sql.c_str(), nullptr, nullptr, &errMsg) != SQLITE_OK) {
+		std::cerr << "SQL error: " << errMsg << "\n";
+		sqlite3_free(errMsg);
+		return(false);
+	}
+	return(true);
+}
+
+static std::vector<int64_t> loadIds(Connection &conn, const char *sql) {
+	std::vector<int64_t> ids;
+	sqlite3_stmt *stmt = nullptr;
+	if (sqlite3_prepare_v2(conn.db, sql, -1, &stmt, nullptr) != SQLITE_OK) return ids;
+	while (sqlite3_step(stmt) == SQLITE_ROW) ids.push_back(sqlite3_column_int64(stmt, 0));
+	sqlite3_finalize(stmt);
+	return ids;
+}
+
+//################################################
+// generating
+
+/*
+ * Picks from n items with item k (counting from 0) chosen in proportion to
+ * 1 / (k + 1)^skew. Items are shuffled first, so the popular ones aren't
+ * simply the lowest ids.
+ */
+class Zipf {
+	std::vector<double> cdf;
+	std::vector<uint32_t> order;
+
+public:
+	Zipf(size_t n, double skew, std::mt19937_64 &rng) : cdf(n), order(n) {
+		double total = 0;
+		for (size_t k = 0; k < n; k++) cdf[k] = total += 1.0 / std::pow((double)(k + 1), skew);
+		for (double &c : cdf) c /= total;
+		std::iota(order.begin(), order.end(), 0);
+		std::shuffle(order.begin(), order.end(), rng);
+	}
+
+	size_t operator()(std::mt19937_64 &rng) {
+		double u = std::uniform_real_distribution<double>(0, 1)(rng);
+		size_t k = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+		return order[std::min(k, order.size() - 1)];
+	}
+};
+
+template<size_t N>
+static const char *pick(const char *const (&words)[N], std::mt19937_64 &rng) {
+	return words[rng() % N];
+}
+
+static const char *const firstNames[] = {
+	"Ava", "Ben", "Chloe", "Diego", "Emma", "Farah", "Gus", "Hana", "Ivan", "Jade", "Kofi", "Lena",
+	"Mateo", "Nora", "Omar", "Priya", "Quinn", "Rosa", "Sam", "Tariq", "Uma", "Vic", "Wen", "Yusuf", "Zoe",
+};
+static const char *const lastNames[] = {
+	"Adams", "Baker", "Chen", "Diaz", "Evans", "Garcia", "Hughes", "Ito", "Jones", "Kim", "Lopez",
+	"Miller", "Nguyen", "Okafor", "Patel", "Reyes", "Smith", "Tanaka", "Walker", "Young",
+};
+static const char *const titleWords[] = {
+	"Midnight", "Silent", "Crimson", "Last", "Broken", "Golden", "Hidden", "Iron", "Lost", "Electric",
+	"Frozen", "Wild", "Distant", "Burning", "Hollow", "Savage", "Velvet", "Shattered", "Endless", "Neon",
+};
+static const char *const titleNouns[] = {
+	"Harbor", "Empire", "Signal", "Garden", "Frontier", "Horizon", "Kingdom", "Echo", "Storm", "Voyage",
+	"Machine", "River", "Legacy", "Protocol", "Requiem", "Station", "Odyssey", "Summit", "Circuit", "Tide",
+};
+static const char *const ratings[] = {"G", "PG", "PG13", "R", "NC17"};
+static const char *const verdicts[] = {
+	"An absolute triumph", "Better than I expected", "A bit slow in the middle", "Not for me",
+	"Worth the ticket", "Gorgeous to look at", "The sequel we deserved", "Forgettable", "Instant classic",
+	"Fun with friends",
+};
+static const char *const details[] = {
+	"the cast is excellent", "the ending drags", "the score is stunning", "the plot has holes",
+	"the effects hold up", "the dialogue sparkles", "the pacing is tight", "it runs too long",
+	"the popcorn was the highlight", "I would see it again",
+};
+
+static bool generateTheaters(Connection &conn, uint64_t count, std::mt19937_64 &rng) {
+	auto start = Clock::now();
+	Loader load(conn);
+	if (!load) return failed(conn, "theaters");
+	for (uint64_t i = 1; i <= count; i++) {
+		std::string name = std::string(pick(titleWords, rng)) + " Cinema " + std::to_string(i);
+		Statement insert(conn, Stmt::InsertTheater);
+		insert.bind(1, name);
+		if (insert.step() != SQLITE_DONE || !load.row()) return failed(conn, "theaters");
+	}
+	if (!load.finish()) return failed(conn, "theaters");
+	progress("Theaters", count, start);
+	return(true);
+}
+
+static bool generateUsers(Connection &conn, uint64_t count, std::mt19937_64 &rng) {
+	auto start = Clock::now();
+	std::string hash = hashPassword(settings.password);
+	if (hash.empty()) {
+		std::cerr << "Can't hash the password for generated users\n";
+		return(false);
+	}
+
+	// Emails carry on from the highest id, so running again adds more users
+	std::vector<int64_t> last = loadIds(conn, "SELECT IFNULL(MAX(id), 0) FROM Users");
+	int64_t base = last.empty() ? 0 : last[0];
+
+	Loader load(conn);
+	if (!load) return failed(conn, "users");
+	for (uint64_t i = 1; i <= count; i++) {
+		std::string name = std::string(pick(firstNames, rng)) + " " + pick(lastNames, rng);
+		std::string email = "user" + std::to_string(base + i) + "@example.com";
+		std::string payment = "card-" + std::to_string(1000 + rng() % 9000);
+		Statement insert(conn, Stmt::InsertUser);
+		insert.bind(1, name);
+		insert.bind(2, email);
+		insert.bind(3, hash);
+		insert.bind(4, payment);
+		if (insert.step() != SQLITE_DONE || !load.row()) return failed(conn, "users");
+	}
+	if (!load.finish()) return failed(conn, "users");
+	progress("Users", count, start);
+	return(true);
+}
+
+static bool generateMovies(Connection &conn, uint64_t count, std::mt19937_64 &rng) {
+	auto start = Clock::now();
+	std::vector<int64_t> theaters = loadIds(conn, "SELECT id FROM Theaters");
+	if (theaters.empty()) {
+		std::cerr << "Movies need at least one theater\n";
+		return(false);
+	}
+
+	time_t now = time(NULL) / 3600 * 3600;
+	Loader load(conn);
+	if (!load) return failed(conn, "movies");
+	for (uint64_t i = 1; i <= count; i++) {
+		std::string name = std::string("The ") + pick(titleWords, rng) + " " + pick(titleNouns, rng);
+		if (rng() % 4 == 0) name += " " + std::to_string(2 + rng() % 4);
+
+		// Showings spread over the next eight weeks, on the hour
+		time_t when = now + (rng() % (56 * 24)) * 3600;
+		char showtime[32];
+		strftime(showtime, sizeof(showtime), "%Y-%m-%d %H:%M", gmtime(&when));
+
+		Statement insert(conn, Stmt::InsertMovie);
+		insert.bind(1, name);
+		insert.bind(2, showtime);
+		sqlite3_bind_double(insert, 3, 5 + (rng() % 1500) / 100.0);
+		insert.bind(4, pick(ratings, rng));
+		sqlite3_bind_int64(insert, 5, theaters[rng() % theaters.size()]);
+		if (insert.step() != SQLITE_DONE || !load.row()) return failed(conn, "movies");
+	}
+	if (!load.finish()) return failed(conn, "movies");
+	progress("Movies", count, start);
+	return(true);
+}
+
+static bool generateTickets(Connection &conn, uint64_t count, std::mt19937_64 &rng) {
+	auto start = Clock::now();
+	std::vector<int64_t> users = loadIds(conn, "SELECT id FROM Users");
+	std::vector<int64_t> movies = loadIds(conn, "SELECT id FROM Movies");
+	if (users.empty() || movies.empty()) {
+		std::cerr << "Tickets need at least one user and one movie\n";
+		return(false);
+	}
+	Zipf movieRank(movies.size(), settings.skew, rng);
+	Zipf userRank(users.size(), settings.userSkew, rng);
+
+	// Bought over the last year. Quantities are mostly one or two.
+	static const int64_t quantities[] = {1, 1, 1, 1, 2, 2, 2, 3, 4, 6};
+	time_t now = time(NULL);
+
+	Loader load(conn);
+	if (!load) return failed(conn, "tickets");
+	for (uint64_t i = 1; i <= count; i++) {
+		std::string bought = std::to_string(now - (int64_t)(rng() % (365 * 86400)));
+		Statement insert(conn, Stmt::InsertTicket);
+		sqlite3_bind_int64(insert, 1, users[userRank(rng)]);
+		sqlite3_bind_int64(insert, 2, movies[movieRank(rng)]);
+		sqlite3_bind_int64(insert, 3, quantities[rng() % 10]);
+		insert.bind(4, bought);
+		if (insert.step() != SQLITE_DONE || !load.row()) return failed(conn, "tickets");
+	}
+	if (!load.finish()) return failed(conn, "tickets");
+	progress("Tickets", count, start);
+	return(true);
+}
+
+static bool generateReviews(Connection &conn, uint64_t count, std::mt19937_64 &rng) {
+	auto start = Clock::now();
+	std::vector<int64_t> users = loadIds(conn, "SELECT id FROM Users");
+	std::vector<int64_t> movies = loadIds(conn, "SELECT id FROM Movies");
+	if (users.empty() || movies.empty()) {
+		std::cerr << "Reviews need at least one user and one movie\n";
+		return(false);
+	}
+	// Popular movies get reviewed more, a user reviews a movie at most once.
+	// Pairs are numbered user index * movies + movie index.
+	Zipf movieRank(movies.size(), settings.skew, rng);
+	std::unordered_set<uint64_t> reviewed = {};
+	uint64_t pairs = (uint64_t)users.size() * movies.size();
+
+	// Pairs reviewed by an earlier run are taken already
+	std::unordered_map<int64_t, size_t> userIndex, movieIndex;
+	for (size_t i = 0; i < users.size(); i++) userIndex[users[i]] = i;
+	for (size_t i = 0; i < movies.size(); i++) movieIndex[movies[i]] = i;
+	sqlite3_stmt *existing = nullptr;
+	if (sqlite3_prepare_v2(conn.db, "SELECT user_id, movie_id FROM Reviews", -1, &existing, nullptr) != SQLITE_OK)
+		return failed(conn, "reviews");
+	while (sqlite3_step(existing) == SQLITE_ROW) {
+		auto user = userIndex.find(sqlite3_column_int64(existing, 0));
+		auto movie = movieIndex.find(sqlite3_column_int64(existing, 1));
+		if (user != userIndex.end() && movie != movieIndex.end()) reviewed.insert((uint64_t)user->second * movies.size() + movie->second);
+	}
+	sqlite3_finalize(existing);
+	count = std::min<uint64_t>(count, pairs - reviewed.size());
+
+	// Once the draws keep landing on taken pairs, the next free pair in
+	// order is used instead, so a nearly full table still finishes
+	uint64_t written = 0, misses = 0, scan = 0;
+	Loader load(conn);
+	if (!load) return failed(conn, "reviews");
+	while (written < count && reviewed.size() < pairs) {
+		uint64_t pair;
+		if (misses < 64) {
+			pair = (uint64_t)(rng() % users.size()) * movies.size() + movieRank(rng);
+		} else {
+			while (reviewed.count(scan)) scan++;
+			pair = scan;
+		}
+		if (!reviewed.insert(pair).second) {
+			misses++;
+			continue;
+		}
+		misses = 0;
+
+		std::string text = std::string(pick(verdicts, rng)) + ", " + pick(details, rng) + ".";
+		Statement insert(conn, Stmt::InsertReview);
+		sqlite3_bind_int64(insert, 1, users[pair / movies.size()]);
+		sqlite3_bind_int64(insert, 2, movies[pair % movies.size()]);
+		insert.bind(3, text);
+		int rc = insert.step();
+		// Written by someone else since the pairs were read, it stays taken
+		if (rc == SQLITE_CONSTRAINT) continue;
+		if (rc != SQLITE_DONE || !load.row()) return failed(conn, "reviews");
+		written++;
+	}
+	if (!load.finish()) return failed(conn, "reviews");
+	progress("Reviews", written, start);
+	return(true);
+}
+
+//################################################
+// importing
+
+// Tables that can be imported, in the order they have to go in
+static const char *const importOrder[] = {"Theaters", "Users", "Movies", "Admins", "Seats", "Tickets", "Reviews"};
+
+/*
+ * Reads one CSV record (RFC 4180: fields may be quoted, quotes inside are
+ * doubled, quoted fields may span lines). False at end of file.
+ */
+static bool readRecord(std::istream &in, std::vector<std::string> &fields) {
+	fields.clear();
+	if (in.peek() == EOF) return(false);
+
+	std::string field;
+	bool quoted = false;
+	int c;
+	while ((c = in.get()) != EOF) {
+		if (quoted) {
+			if (c != '"') field += (char)c;
+			else if (in.peek() == '"') field += (char)in.get();
+			else quoted = false;
+		} else if (c == '"') {
+			quoted = true;
+		} else if (c == ',') {
+			fields.push_back(std::move(field));
+			field.clear();
+		} else if (c == '\n') {
+			break;
+		} else if (c != '\r') {
+			field += (char)c;
+		}
+	}
+	fields.push_back(std::move(field));
+	return(true);
+}
+
+/*
+ * Loads a CSV file whose first line names the columns. Empty fields are
+ * stored as NULL, everything else is bound as text and converted by the
+ * column's type. For a column's default, leave it out of the header.
+ */
+static bool importCsv(Connection &conn, const std::string &table, const std::string &path) {
+	auto start = Clock::now();
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		std::cerr << "Can't open " << path << "\n";
+		return(false);
+	}
+
+	std::vector<std::string> columns, fields;
+	if (!readRecord(in, columns) || columns.empty()) {
+		std::cerr << path << " has no header line\n";
+		return(false);
+	}
+	std::string sql = "INSERT INTO " + table + " (", values;
+	for (size_t i = 0; i < columns.size(); i++) {
+		if (columns[i].find('"') != std::string::npos) {
+			std::cerr << path << ": bad column name " << columns[i] << "\n";
+			return(false);
+		}
+		sql += (i ? ", \"" : "\"") + columns[i] + "\"";
+		values += i ? ", ?" : "?";
+	}
+	sql += ") VALUES (" + values + ")";
+
+	sqlite3_stmt *stmt = nullptr;
+	if (sqlite3_prepare_v2(conn.db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) return failed(conn, path.c_str());
+	std::unique_ptr<sqlite3_stmt, int (*)(sqlite3_stmt*)> finalize(stmt, sqlite3_finalize);
+
+	uint64_t rows = 0, line = 1;
+	Loader load(conn);
+	if (!load) return failed(conn, path.c_str());
+	while (readRecord(in, fields)) {
+		line++;
+		if (fields.size() == 1 && fields[0].empty()) continue;
+		if (fields.size() != columns.size()) {
+			std::cerr << path << ":" << line << ": expected " << columns.size() << " fields, got " << fields.size() << "\n";
+			return(false);
+		}
+		for (size_t i = 0; i < fields.size(); i++) {
+			if (fields[i].empty()) sqlite3_bind_null(stmt, i + 1);
+			else sqlite3_bind_text(stmt, i + 1, fields[i].data(), (int)fields[i].size(), SQLITE_STATIC);
+		}
+		int rc = sqlite3_step(stmt);
+		sqlite3_reset(stmt);
+		if (rc != SQLITE_DONE) {
+			std::cerr << path << ":" << line << ": ";
+			return failed(conn, table.c_str());
+		}
+		if (!load.row()) return failed(conn, table.c_str());
+		rows++;
+	}
+	if (!load.finish()) return failed(conn, table.c_str());
+	progress((table + " from " + path).c_str(), rows, start);
+	return(true);
+}
+
+//################################################
+// command line
+
+enum {
+	OPT_USERS = 256,
+	OPT_THEATERS,
+	OPT_MOVIES,
+	OPT_TICKETS,
+	OPT_REVIEWS,
+	OPT_SKEW,
+	OPT_CAPACITY,
+	OPT_SEED,
+	OPT_BATCH,
+	OPT_CACHE,
+	OPT_PASSWORD,
+	OPT_IMPORT,
+};
+
+static struct argp_option options[] = {
+	{"database", 'o',          "FILE",  0, "Database to fill, created if missing (default: " DATABASE_FILE ")", 0},
+	{"users",    OPT_USERS,    "N",     0, "Users to generate (default: 100000)", 0},
+	{"theaters", OPT_THEATERS, "N",     0, "Theaters to generate (default: 50)", 0},
+	{"movies",   OPT_MOVIES,   "N",     0, "Movies (showings) to generate (default: 2000)", 0},
+	{"tickets",  OPT_TICKETS,  "N",     0, "Tickets to generate (default: 1000000)", 0},
+	{"reviews",  OPT_REVIEWS,  "N",     0, "Reviews to generate (default: 20000)", 0},
+	{"skew",     OPT_SKEW,     "S",     0, "How much sales favour the top movies, 0 is even (default: 1.2)", 0},
+	{"capacity", OPT_CAPACITY, "SEATS", 0, "Seats per showing, at least what it sold (default: 500)", 0},
+	{"seed",     OPT_SEED,     "N",     0, "Random seed, the same seed gives the same data (default: 42)", 0},
+	{"batch",    OPT_BATCH,    "ROWS",  0, "Rows per transaction (default: 100000)", 0},
+	{"cache",    OPT_CACHE,    "MIB",   0, "Page cache while loading (default: 512)", 0},
+	{"password", OPT_PASSWORD, "TEXT",  0, "Password of every generated user (default: password)", 0},
+	{"import",   OPT_IMPORT,   "TABLE=FILE", 0, "Load a CSV file with a header line into a table, may be repeated. "
+		"Only the tables given a count are generated as well.", 0},
+	{0, 0, 0, 0, 0, 0}
+};
+
+static uint64_t count(char *arg, struct argp_state *state) {
+	char *end;
+	errno = 0;
+	unsigned long long value = strtoull(arg, &end, 10);
+	if (errno || *end || arg[0] == '-') argp_error(state, "%s is not a count", arg);
+	return value;
+}
+
+static error_t parseOpt(int key, char *arg, struct argp_state *state) {
+	switch (key) {
+		case 'o': settings.database = arg; break;
+		case OPT_USERS: settings.users = count(arg, state); break;
+		case OPT_THEATERS: settings.theaters = count(arg, state); break;
+		case OPT_MOVIES: settings.movies = count(arg, state); break;
+		case OPT_TICKETS: settings.tickets = count(arg, state); break;
+		case OPT_REVIEWS: settings.reviews = count(arg, state); break;
+		case OPT_SKEW:
+			if (atof(arg) < 0) argp_error(state, "skew can't be negative");
+			settings.skew = atof(arg);
+			break;
+		case OPT_CAPACITY: settings.capacity = count(arg, state); break;
+		case OPT_SEED: settings.seed = count(arg, state); break;
+		case OPT_BATCH:
+			settings.batch = count(arg, state);
+			if (!settings.batch) argp_error(state, "batch must be at least 1");
+			break;
+		case OPT_CACHE: settings.cache = count(arg, state); break;
+		case OPT_PASSWORD: settings.password = arg; break;
+		case OPT_IMPORT: {
+			const char *eq = strchr(arg, '=');
+			if (!eq) argp_error(state, "--import takes TABLE=FILE");
+			std::string table(arg, eq - arg);
+			auto known = std::find_if(std::begin(importOrder), std::end(importOrder),
+				[&](const char *name) { return strcasecmp(name, table.c_str()) == 0; });
+			if (known == std::end(importOrder)) argp_error(state, "can't import into %s", table.c_str());
+			settings.imports.push_back({*known, eq + 1});
+			break;
+		}
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp argParser = {options, parseOpt, 0, "Synthetic data generator and bulk loader for the movie booking system backend", 0, 0, 0};
+
+//################################################
+int main(int argc, char *argv[]) {
+	argp_parse(&argParser, argc, argv, 0, 0, 0);
+
+	// Without imports, whatever wasn't given gets a capacity-test sized default
+	if (settings.imports.empty()) {
+		if (!settings.users) settings.users = 100000;
+		if (!settings.theaters) settings.theaters = 50;
+		if (!settings.movies) settings.movies = 2000;
+		if (!settings.tickets) settings.tickets = 1000000;
+		if (!settings.reviews) settings.reviews = 20000;
+	}
+
+	if (!dbWriter.open(settings.database.c_str(), 1, false)) return(1);
+	auto conn = dbWriter.acquire();
+	if (!runMigrations(conn->db)) return(1);
+
+	// Load settings: nothing synced, the journal only in memory and nobody else let in
+	std::string pragmas =
+		"PRAGMA journal_mode = MEMORY;"
+		"PRAGMA synchronous = OFF;"
+		"PRAGMA locking_mode = EXCLUSIVE;"
+		"PRAGMA cache_size = -" + std::to_string((uint64_t)settings.cache * 1024) + ";";
+	if (!execute(*conn, pragmas)) return(1);
+
+	auto start = Clock::now();
+	std::mt19937_64 rng(settings.seed);
+
+	for (const char *table : importOrder) {
+		for (auto &[into, path] : settings.imports) {
+			if (into == table && !importCsv(*conn, into, path)) return(1);
+		}
+	}
+
+	if (settings.theaters.value_or(0) && !generateTheaters(*conn, *settings.theaters, rng)) return(1);
+	if (settings.users.value_or(0) && !generateUsers(*conn, *settings.users, rng)) return(1);
+	if (settings.movies.value_or(0) && !generateMovies(*conn, *settings.movies, rng)) return(1);
+	if (settings.tickets.value_or(0) && !generateTickets(*conn, *settings.tickets, rng)) return(1);
+	if (settings.reviews.value_or(0) && !generateReviews(*conn, *settings.reviews, rng)) return(1);
+
+	// Every showing's sold count is set from its sales, so tickets added by a
+	// re-run are counted too. New showings get --capacity seats, and any
+	// showing is raised to cover what it sold. (WHERE true keeps SQLite from
+	// reading ON CONFLICT as part of the join.)
+	std::string seats =
+		"INSERT INTO Seats (movie_id, capacity, sold)"
+		"	SELECT M.id, MAX(" + std::to_string(settings.capacity) + ", IFNULL(S.tickets_sold, 0)), IFNULL(S.tickets_sold, 0)"
+		"		FROM Movies M LEFT JOIN MovieSales S ON S.movie_id = M.id WHERE true"
+		"	ON CONFLICT (movie_id) DO UPDATE SET sold = excluded.sold, capacity = MAX(capacity, excluded.sold);";
+	if (!execute(*conn, seats)) return(1);
+
+	// Statistics for the query planner, then back to how the server runs
+	std::cout << "Analyzing and switching back to WAL\n";
+	if (!execute(*conn, "PRAGMA analysis_limit = 1000; ANALYZE; PRAGMA locking_mode = NORMAL; PRAGMA journal_mode = WAL;")) return(1);
+
+	std::cout << "Done in " << std::fixed << std::setprecision(1) << std::chrono::duration<double>(Clock::now() - start).count() << "s\n";
+	return(0);
+}